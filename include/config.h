@@ -3,8 +3,34 @@
 
 #define CONFIG_MAX_ROUTINES 16
 
+// Run the routine interpreter from a Timer2 compare-match interrupt instead of loop()
+#define CONFIG_ROUTINE_TICK_ISR false
+#define CONFIG_ROUTINE_TICK_US 1000
+// Bytes of RAM reserved in tick mode for the copy of the routine image the interpreter executes from
+#define CONFIG_ROUTINE_IMAGE_SIZE 256
+// Instructions a routine may execute in one pass before yielding to the other routines
+#define CONFIG_ROUTINE_INSTRUCTION_BUDGET 8
+// Instructions all routines together may execute in one pass, due routines run in priority order
+#define CONFIG_ROUTINE_PASS_BUDGET 64
+// How late a routine may run after its delay expired or it was triggered before it counts as a missed deadline
+#define CONFIG_ROUTINE_DEADLINE_SLACK_US 2000
+// Triggers each routine can hold while it is running
+#define CONFIG_TRIGGER_QUEUE_SIZE 4
+// How long a button must hold a new level before a press counts for the restart, queue and coalesce policies
+#define CONFIG_BUTTON_DEBOUNCE_US 20000
+
+// What a pin ends up as when different routines drive it high and low in the same pass, one routine always gets its last write
+#define CONFIG_OUTPUT_CONFLICT_LOW_WINS 0
+#define CONFIG_OUTPUT_CONFLICT_HIGH_WINS 1
+#define CONFIG_OUTPUT_CONFLICT_LAST_WINS 2
+#define CONFIG_OUTPUT_CONFLICT_POLICY CONFIG_OUTPUT_CONFLICT_LOW_WINS
+
+// RAM ring buffer of routine events, exported with the 't' command; size must be a power of two
+#define CONFIG_TRACE true
+#define CONFIG_TRACE_SIZE 32
+
 #define CONFIG_DEBUG true
 #define CONFIG_DEBUG_ROUTINE_TIMERS false
 #define CONFIG_DEBUG_DISABLE_FORCE_FLUSH false
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,69 @@
+#include "boot/boot.h"
+#include "data/data.h"
+#include "output_stage/output_stage.h"
+#include "utils/utils.h"
+#include <Arduino.h>
+
+namespace BOOT {
+    uint32_t _safeStateCycles = 0;
+
+    // Runs before main(), nothing here may rely on constructors, interrupts or Serial
+    void applyDefaultPinStates() {
+        uint8_t defaultPinStates[32];
+        if (DATA::readDefaultPinStates(defaultPinStates)) {
+            // Pins that routines drive become outputs at their default, pins they read are left alone and
+            // every other pin only gets its port bit, which is the pull-up while it stays an input
+            uint8_t buttonPins[CONFIG_MAX_ROUTINES];
+            uint8_t buttonCount = DATA::readButtonPins(buttonPins);
+            uint8_t waitPins[DATA::PIN_BITMAP_SIZE];
+            uint8_t drivenPins[DATA::PIN_BITMAP_SIZE];
+            DATA::readRoutinePins(waitPins, drivenPins);
+            OUTPUT_STAGE::clearReservations();
+            for (uint8_t i = 0; i < buttonCount; i++) {
+                OUTPUT_STAGE::reserveInput(buttonPins[i]);
+            }
+            for (uint8_t pin = 0; pin < NUM_DIGITAL_PINS; pin++) {
+                if (waitPins[pin / 8] & _BV(pin % 8)) {
+                    OUTPUT_STAGE::reserveInput(pin);
+                } else if (drivenPins[pin / 8] & _BV(pin % 8)) {
+                    OUTPUT_STAGE::reserveOutput(pin);
+                }
+            }
+
+            for (uint8_t pin = 0; pin < NUM_DIGITAL_PINS; pin++) {
+                if (!validatePin(pin)) {
+                    continue;
+                }
+
+                OUTPUT_STAGE::stage(pin, (defaultPinStates[pin / 8] >> (pin % 8)) & 0x01, OUTPUT_STAGE::NO_OWNER);
+            }
+            OUTPUT_STAGE::commit();
+        }
+
+        _safeStateCycles = TCNT1;
+        if (TIFR1 & _BV(TOV1)) {
+            _safeStateCycles += 0x10000;
+        }
+
+        // Hand Timer1 back in its reset state
+        TCCR1B = 0;
+        TCNT1 = 0;
+        TIFR1 = _BV(TOV1);
+    }
+
+    uint32_t safeStateMicros() {
+        return _safeStateCycles / (F_CPU / 1000000UL);
+    }
+}
+
+// .init3 runs right after the stack is set up, start counting cycles there
+void _bootStartTimer() __attribute__((naked, used, section(".init3")));
+void _bootStartTimer() {
+    TCCR1B = _BV(CS10);
+}
+
+// .init5 runs once .data and .bss are ready, before constructors and main(); the stub only makes the call
+void _bootApplyDefaultPinStates() __attribute__((naked, used, section(".init5")));
+void _bootApplyDefaultPinStates() {
+    BOOT::applyDefaultPinStates();
+}
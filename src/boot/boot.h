@@ -0,0 +1,12 @@
+#ifndef BOOT_h
+#define BOOT_h
+
+#include <Arduino.h>
+
+namespace BOOT {
+    // Called from a naked .init section stub that has no frame of its own, so it must never be inlined there
+    void applyDefaultPinStates() __attribute__((noinline));
+    uint32_t safeStateMicros();
+}
+
+#endif
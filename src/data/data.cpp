@@ -1,5 +1,6 @@
 #include "data.h"
 #include "config.h"
+#include "library/library.h"
 #include "utils/utils.h"
 #include <Arduino.h>
 #include <EEPROM.h>
@@ -12,7 +13,10 @@ const int DEFAULT_PIN_STATES_SIZE = 32;
 const int ROUTINE_COUNT_OFFSET = DEFAULT_PIN_STATES_OFFSET + DEFAULT_PIN_STATES_SIZE;
 const int ROUTINE_COUNT_SIZE = 1;
 const int ROUTINE_META_LIST_OFFSET = ROUTINE_COUNT_OFFSET + ROUTINE_COUNT_SIZE;
-const int ROUTINE_META_SIZE = 3;
+const int ROUTINE_META_SIZE_V1 = 3;
+const int ROUTINE_META_SIZE_V2 = 4;
+const int ROUTINE_META_SIZE_V3 = 5;
+const int ROUTINE_META_SIZE = 6;
 
 const uint8_t DEFAULT_EEPROM_VALUE = 0xFF;
 
@@ -22,145 +26,371 @@ namespace DATA {
     int _routineOffsetList[CONFIG_MAX_ROUTINES];
 
     void _calculateRoutineOffsetList();
+    int _routineMetaSize(uint8_t dataVersion);
+    uint8_t _readStoredByte(RoutineMeta *routineMeta, int offset, uint16_t byteIndex);
+    void _readRoutineMeta(uint8_t dataVersion, int routineIndex, RoutineMeta *routineMeta);
+    void _writeRoutineMeta(int routineIndex, RoutineMeta *routineMeta);
+    bool _migrate(uint8_t dataVersion);
 
     Meta* readMeta() {
         if (_meta != nullptr) {
             return _meta;
         }
 
-        DEBUG_PRINTLN("Read meta");
+        DEBUG_PRINTLN(F("Read meta"));
 
         if (EEPROM.read(META_DATA_VERSION_OFFSET) == DEFAULT_EEPROM_VALUE) {
-            DEBUG_PRINTLN("Uninitialized EEPROM found");
+            DEBUG_PRINTLN(F("Uninitialized EEPROM found"));
             initializeEEPROM();
         }
 
+        bool migrated = true;
+        if (EEPROM.read(META_DATA_VERSION_OFFSET) < MAX_SUPPORTED_DATA_VERSION) {
+            migrated = _migrate(EEPROM.read(META_DATA_VERSION_OFFSET));
+        }
+
         _meta = new Meta();
         _meta->dataVersion = EEPROM.read(META_DATA_VERSION_OFFSET);
-        DEBUG_PRINT("Data version: ");
+        DEBUG_PRINT(F("Data version: "));
         DEBUG_PRINTLN(_meta->dataVersion);
 
         _meta->routineCount = EEPROM.read(ROUTINE_COUNT_OFFSET);
         if (_meta->routineCount == DEFAULT_EEPROM_VALUE || _meta->routineCount > CONFIG_MAX_ROUTINES) {
             _meta->routineCount = 0;
         }
-        DEBUG_PRINT("Routine count: ");
+        if (!migrated) {
+            // The entries are still in the old layout, which the offsets and writeMeta do not understand.
+            // EEPROM is left untouched; the next write stores the current layout under the current version.
+            Serial.println(F("E: Routines not loaded, data could not be migrated"));
+            _meta->dataVersion = MAX_SUPPORTED_DATA_VERSION;
+            _meta->routineCount = 0;
+        }
+        DEBUG_PRINT(F("Routine count: "));
         DEBUG_PRINTLN(_meta->routineCount);
 
-        DEBUG_PRINT("Default pin state: ");
+        DEBUG_PRINT(F("Default pin state: "));
         for (int i = 0; i < DEFAULT_PIN_STATES_SIZE; i++) {
             _meta->defaultPinStates[i] = EEPROM.read(DEFAULT_PIN_STATES_OFFSET + i);
             DEBUG_PRINT(byteToBin(_meta->defaultPinStates[i]));
         }
         DEBUG_PRINTLN();
 
-        DEBUG_PRINTLN("Routine meta list:");
+        DEBUG_PRINTLN(F("Routine meta list:"));
         _meta->routineMetaList = _routineMetaList;
         for (int i = 0; i < _meta->routineCount; i++) {
             RoutineMeta *routineMeta = &_routineMetaList[i];
-            routineMeta->buttonPin = EEPROM.read(ROUTINE_META_LIST_OFFSET + i * ROUTINE_META_SIZE);
-            routineMeta->length = EEPROM.read(ROUTINE_META_LIST_OFFSET + i * ROUTINE_META_SIZE + 1) << 8 |
-                EEPROM.read(ROUTINE_META_LIST_OFFSET + i * ROUTINE_META_SIZE + 2);
+            _readRoutineMeta(_meta->dataVersion, i, routineMeta);
             
-            DEBUG_PRINT("Routine ");
+            DEBUG_PRINT(F("Routine "));
             DEBUG_PRINT(i);
-            DEBUG_PRINT(" button pin: ");
+            DEBUG_PRINT(F(" button pin: "));
             DEBUG_PRINT(routineMeta->buttonPin);
-            DEBUG_PRINT(" length: ");
-            DEBUG_PRINTLN(routineMeta->length);
+            DEBUG_PRINT(F(" length: "));
+            DEBUG_PRINT(routineMeta->length);
+            DEBUG_PRINT(F(" retrigger: "));
+            DEBUG_PRINT(routineMeta->retriggerPolicy);
+            DEBUG_PRINT(F("/"));
+            DEBUG_PRINT(routineMeta->retriggerDepth);
+            DEBUG_PRINT(F(" priority: "));
+            DEBUG_PRINT(routineMeta->priority);
+            DEBUG_PRINT(F(" source: "));
+            DEBUG_PRINTLN(routineMeta->source);
         }
 
         _calculateRoutineOffsetList();
 
-        DEBUG_PRINTLN("Read meta done");
+        DEBUG_PRINTLN(F("Read meta done"));
 
         return _meta;
     }
 
     void writeMeta() {
-        DEBUG_PRINTLN("Write meta");
+        DEBUG_PRINTLN(F("Write meta"));
 
         EEPROM.write(META_DATA_VERSION_OFFSET, _meta->dataVersion);
-        DEBUG_PRINT("Data version: ");
+        DEBUG_PRINT(F("Data version: "));
         DEBUG_PRINTLN(_meta->dataVersion);
 
         EEPROM.write(ROUTINE_COUNT_OFFSET, _meta->routineCount);
-        DEBUG_PRINT("Routine count: ");
+        DEBUG_PRINT(F("Routine count: "));
         DEBUG_PRINTLN(_meta->routineCount);
 
-        DEBUG_PRINT("Default pin state: ");
+        DEBUG_PRINT(F("Default pin state: "));
         for (int i = 0; i < DEFAULT_PIN_STATES_SIZE; i++) {
             EEPROM.write(DEFAULT_PIN_STATES_OFFSET + i, _meta->defaultPinStates[i]);
             DEBUG_PRINT(byteToBin(_meta->defaultPinStates[i]));
         }
         DEBUG_PRINTLN();
         
-        DEBUG_PRINTLN("Routine meta list:");
+        DEBUG_PRINTLN(F("Routine meta list:"));
         for (int i = 0; i < _meta->routineCount; i++) {
             RoutineMeta *routineMeta = &_routineMetaList[i];
-            EEPROM.write(ROUTINE_META_LIST_OFFSET + i * ROUTINE_META_SIZE, routineMeta->buttonPin);
-            EEPROM.write(ROUTINE_META_LIST_OFFSET + i * ROUTINE_META_SIZE + 1, routineMeta->length >> 8);
-            EEPROM.write(ROUTINE_META_LIST_OFFSET + i * ROUTINE_META_SIZE + 2, routineMeta->length & 0xFF);
+            _writeRoutineMeta(i, routineMeta);
 
-            DEBUG_PRINT("Routine ");
+            DEBUG_PRINT(F("Routine "));
             DEBUG_PRINT(i);
-            DEBUG_PRINT(" button pin: ");
+            DEBUG_PRINT(F(" button pin: "));
             DEBUG_PRINT(routineMeta->buttonPin);
-            DEBUG_PRINT(" length: ");
-            DEBUG_PRINTLN(routineMeta->length);
+            DEBUG_PRINT(F(" length: "));
+            DEBUG_PRINT(routineMeta->length);
+            DEBUG_PRINT(F(" retrigger: "));
+            DEBUG_PRINT(routineMeta->retriggerPolicy);
+            DEBUG_PRINT(F("/"));
+            DEBUG_PRINT(routineMeta->retriggerDepth);
+            DEBUG_PRINT(F(" priority: "));
+            DEBUG_PRINT(routineMeta->priority);
+            DEBUG_PRINT(F(" source: "));
+            DEBUG_PRINTLN(routineMeta->source);
         }
 
         _calculateRoutineOffsetList();
 
-        DEBUG_PRINTLN("Write meta done");
+        DEBUG_PRINTLN(F("Write meta done"));
     }
 
     void _calculateRoutineOffsetList() {
-        DEBUG_PRINTLN("Calculate routine offset list");
+        DEBUG_PRINTLN(F("Calculate routine offset list"));
 
         int offset = ROUTINE_META_LIST_OFFSET + _meta->routineCount * ROUTINE_META_SIZE;
         for (int i = 0; i < _meta->routineCount; i++) {
             _routineOffsetList[i] = offset;
-            offset += _routineMetaList[i].length;
+            if (_routineMetaList[i].source == SOURCE_EEPROM) {
+                offset += _routineMetaList[i].length;
+            }
 
-            DEBUG_PRINT("Routine ");
+            DEBUG_PRINT(F("Routine "));
             DEBUG_PRINT(i);
-            DEBUG_PRINT(" offset: ");
+            DEBUG_PRINT(F(" offset: "));
             DEBUG_PRINTLN(_routineOffsetList[i]);
         }
     }
 
+    bool readDefaultPinStates(uint8_t *defaultPinStates) {
+        // Used at boot before anything else is set up, so no meta cache and no logging
+        if (EEPROM.read(META_DATA_VERSION_OFFSET) == DEFAULT_EEPROM_VALUE) {
+            return false;
+        }
+
+        for (int i = 0; i < DEFAULT_PIN_STATES_SIZE; i++) {
+            defaultPinStates[i] = EEPROM.read(DEFAULT_PIN_STATES_OFFSET + i);
+        }
+        return true;
+    }
+
+    uint8_t readButtonPins(uint8_t *buttonPins) {
+        // Used at boot like readDefaultPinStates, reads the meta entries in whatever layout they are stored in
+        uint8_t dataVersion = EEPROM.read(META_DATA_VERSION_OFFSET);
+        uint8_t routineCount = EEPROM.read(ROUTINE_COUNT_OFFSET);
+        if (dataVersion == DEFAULT_EEPROM_VALUE || routineCount == DEFAULT_EEPROM_VALUE || routineCount > CONFIG_MAX_ROUTINES) {
+            return 0;
+        }
+
+        for (int i = 0; i < routineCount; i++) {
+            buttonPins[i] = EEPROM.read(ROUTINE_META_LIST_OFFSET + i * _routineMetaSize(dataVersion));
+        }
+        return routineCount;
+    }
+
+    void readRoutinePins(uint8_t *waitPins, uint8_t *drivenPins) {
+        // Used at boot like readButtonPins, walks the routines in whatever layout they are stored in
+        for (int i = 0; i < PIN_BITMAP_SIZE; i++) {
+            waitPins[i] = 0;
+            drivenPins[i] = 0;
+        }
+
+        uint8_t dataVersion = EEPROM.read(META_DATA_VERSION_OFFSET);
+        uint8_t routineCount = EEPROM.read(ROUTINE_COUNT_OFFSET);
+        if (dataVersion == DEFAULT_EEPROM_VALUE || routineCount == DEFAULT_EEPROM_VALUE || routineCount > CONFIG_MAX_ROUTINES) {
+            return;
+        }
+
+        int offset = ROUTINE_META_LIST_OFFSET + routineCount * _routineMetaSize(dataVersion);
+        for (int i = 0; i < routineCount; i++) {
+            RoutineMeta routineMeta;
+            _readRoutineMeta(dataVersion, i, &routineMeta);
+            if (routineMeta.source == SOURCE_EEPROM && offset + routineMeta.length > (int)EEPROM.length()) {
+                return;
+            }
+
+            uint16_t byteIndex = 0;
+            while (byteIndex < routineMeta.length) {
+                uint8_t instruction = _readStoredByte(&routineMeta, offset, byteIndex);
+                uint8_t length = ROUTINE::instructionLength(instruction);
+                if (length == 0 || byteIndex + length > routineMeta.length) {
+                    break;
+                }
+
+                uint8_t *pins = nullptr;
+                switch (instruction) {
+                    case ROUTINE::INSTRUCTION_WAIT_PIN_HIGH:
+                    case ROUTINE::INSTRUCTION_WAIT_PIN_LOW:
+                        pins = waitPins;
+                        break;
+                    case ROUTINE::INSTRUCTION_PIN_LOW:
+                    case ROUTINE::INSTRUCTION_PIN_HIGH:
+                    case ROUTINE::INSTRUCTION_PWM_SET:
+                    case ROUTINE::INSTRUCTION_PULSE_TRAIN:
+                        pins = drivenPins;
+                        break;
+                }
+
+                if (pins != nullptr) {
+                    uint8_t pin = _readStoredByte(&routineMeta, offset, byteIndex + 1);
+                    if (pin < NUM_DIGITAL_PINS) {
+                        pins[pin / 8] |= _BV(pin % 8);
+                    }
+                }
+                byteIndex += length;
+            }
+
+            if (routineMeta.source == SOURCE_EEPROM) {
+                offset += routineMeta.length;
+            }
+        }
+    }
+
+    uint8_t _readStoredByte(RoutineMeta *routineMeta, int offset, uint16_t byteIndex) {
+        if (routineMeta->source != SOURCE_EEPROM) {
+            return LIBRARY::readByte(routineMeta->source - 1, byteIndex);
+        }
+
+        return EEPROM.read(offset + byteIndex);
+    }
+
+    int _routineMetaSize(uint8_t dataVersion) {
+        switch (dataVersion) {
+            case 0x01:
+                return ROUTINE_META_SIZE_V1;
+            case 0x02:
+                return ROUTINE_META_SIZE_V2;
+            case 0x03:
+                return ROUTINE_META_SIZE_V3;
+            default:
+                return ROUTINE_META_SIZE;
+        }
+    }
+
+    void _readRoutineMeta(uint8_t dataVersion, int routineIndex, RoutineMeta *routineMeta) {
+        int offset = ROUTINE_META_LIST_OFFSET + routineIndex * _routineMetaSize(dataVersion);
+
+        routineMeta->buttonPin = EEPROM.read(offset);
+        routineMeta->length = EEPROM.read(offset + 1) << 8 | EEPROM.read(offset + 2);
+
+        // Fields added after version 1 fall back to the old behaviour
+        routineMeta->retriggerPolicy = 0;
+        routineMeta->retriggerDepth = 0;
+        if (dataVersion >= 0x02) {
+            uint8_t retrigger = EEPROM.read(offset + 3);
+            routineMeta->retriggerPolicy = retrigger >> 4;
+            routineMeta->retriggerDepth = retrigger & 0x0F;
+        }
+
+        routineMeta->priority = 0;
+        if (dataVersion >= 0x03) {
+            routineMeta->priority = EEPROM.read(offset + 4);
+        }
+
+        // Flash routines take no EEPROM, their length comes from the library
+        routineMeta->source = SOURCE_EEPROM;
+        if (dataVersion >= 0x04) {
+            routineMeta->source = EEPROM.read(offset + 5);
+            if (routineMeta->source != SOURCE_EEPROM) {
+                routineMeta->length = LIBRARY::length(routineMeta->source - 1);
+            }
+        }
+    }
+
+    void _writeRoutineMeta(int routineIndex, RoutineMeta *routineMeta) {
+        int offset = ROUTINE_META_LIST_OFFSET + routineIndex * ROUTINE_META_SIZE;
+
+        uint16_t length = routineMeta->source == SOURCE_EEPROM ? routineMeta->length : 0;
+        EEPROM.write(offset, routineMeta->buttonPin);
+        EEPROM.write(offset + 1, length >> 8);
+        EEPROM.write(offset + 2, length & 0xFF);
+        EEPROM.write(offset + 3, routineMeta->retriggerPolicy << 4 | (routineMeta->retriggerDepth & 0x0F));
+        EEPROM.write(offset + 4, routineMeta->priority);
+        EEPROM.write(offset + 5, routineMeta->source);
+    }
+
+    bool _migrate(uint8_t dataVersion) {
+        DEBUG_PRINT(F("Migrate data version "));
+        DEBUG_PRINT(dataVersion);
+        DEBUG_PRINT(F(" to "));
+        DEBUG_PRINTLN(MAX_SUPPORTED_DATA_VERSION);
+
+        uint8_t routineCount = EEPROM.read(ROUTINE_COUNT_OFFSET);
+        if (routineCount == DEFAULT_EEPROM_VALUE || routineCount > CONFIG_MAX_ROUTINES) {
+            routineCount = 0;
+        }
+
+        RoutineMeta routineMetaList[CONFIG_MAX_ROUTINES];
+        int routinesLength = 0;
+        for (int i = 0; i < routineCount; i++) {
+            _readRoutineMeta(dataVersion, i, &routineMetaList[i]);
+            if (routineMetaList[i].source == SOURCE_EEPROM) {
+                routinesLength += routineMetaList[i].length;
+            }
+        }
+
+        int oldRoutinesOffset = ROUTINE_META_LIST_OFFSET + routineCount * _routineMetaSize(dataVersion);
+        int newRoutinesOffset = ROUTINE_META_LIST_OFFSET + routineCount * ROUTINE_META_SIZE;
+        if (newRoutinesOffset + routinesLength > (int)EEPROM.length()) {
+            DEBUG_PRINTLN(F("E: Routines do not fit after migration"));
+            return false;
+        }
+
+        // Meta entries only grow, so routine bytes move up and are copied from the end
+        for (int i = routinesLength - 1; i >= 0; i--) {
+            EEPROM.update(newRoutinesOffset + i, EEPROM.read(oldRoutinesOffset + i));
+        }
+        for (int i = routineCount - 1; i >= 0; i--) {
+            _writeRoutineMeta(i, &routineMetaList[i]);
+        }
+
+        EEPROM.write(META_DATA_VERSION_OFFSET, MAX_SUPPORTED_DATA_VERSION);
+
+        DEBUG_PRINTLN(F("Migrate done"));
+
+        return true;
+    }
+
     uint8_t readRoutineByte(unsigned int routineIndex, uint16_t byteIndex) {
         if (_meta == nullptr) {
-            DEBUG_PRINTLN("E: Meta is null");
+            DEBUG_PRINTLN(F("E: Meta is null"));
             return 0;
         }
 
         if (routineIndex >= _meta->routineCount) {
-            DEBUG_PRINT("E: Routine index out of bounds, ");
+            DEBUG_PRINT(F("E: Routine index out of bounds, "));
             DEBUG_PRINT(routineIndex);
-            DEBUG_PRINT("/");
+            DEBUG_PRINT(F("/"));
             DEBUG_PRINTLN(_meta->routineCount);
             return 0;
         }
 
         if (byteIndex >= _routineMetaList[routineIndex].length) {
-            DEBUG_PRINT("E: Byte index out of bounds, ");
+            DEBUG_PRINT(F("E: Byte index out of bounds, "));
             DEBUG_PRINT(byteIndex);
-            DEBUG_PRINT("/");
+            DEBUG_PRINT(F("/"));
             DEBUG_PRINTLN(_routineMetaList[routineIndex].length);
             return 0;
         }
 
-        uint8_t value = EEPROM.read(_routineOffsetList[routineIndex] + byteIndex);
-
-        DEBUG_PRINT("Reading routine ");
+        uint8_t value;
+        DEBUG_PRINT(F("Reading routine "));
         DEBUG_PRINT(routineIndex);
-        DEBUG_PRINT(" at ");
+        DEBUG_PRINT(F(" at "));
         DEBUG_PRINT(byteIndex);
-        DEBUG_PRINT(" (");
-        DEBUG_PRINT(_routineOffsetList[routineIndex] + byteIndex);
-        DEBUG_PRINT("): ");
+        if (_routineMetaList[routineIndex].source != SOURCE_EEPROM) {
+            value = LIBRARY::readByte(_routineMetaList[routineIndex].source - 1, byteIndex);
+            DEBUG_PRINT(F(" (flash "));
+            DEBUG_PRINT(_routineMetaList[routineIndex].source - 1);
+        } else {
+            value = EEPROM.read(_routineOffsetList[routineIndex] + byteIndex);
+            DEBUG_PRINT(F(" ("));
+            DEBUG_PRINT(_routineOffsetList[routineIndex] + byteIndex);
+        }
+        DEBUG_PRINT(F("): "));
         DEBUG_PRINTLN(byteToHex(value));
 
         return value;
@@ -168,22 +398,27 @@ namespace DATA {
 
     bool writeRoutineByte(unsigned int routineIndex, uint16_t byteIndex, uint8_t value) {
         if (_meta == nullptr) {
-            DEBUG_PRINTLN("E: Meta is null");
+            DEBUG_PRINTLN(F("E: Meta is null"));
             return false;
         }
 
         if (routineIndex >= _meta->routineCount) {
-            DEBUG_PRINT("E: Routine index out of bounds, ");
+            DEBUG_PRINT(F("E: Routine index out of bounds, "));
             DEBUG_PRINT(routineIndex);
-            DEBUG_PRINT("/");
+            DEBUG_PRINT(F("/"));
             DEBUG_PRINTLN(_meta->routineCount);
             return false;
         }
 
+        if (_routineMetaList[routineIndex].source != SOURCE_EEPROM) {
+            DEBUG_PRINTLN(F("E: Routine is stored in flash"));
+            return false;
+        }
+
         if (byteIndex >= _routineMetaList[routineIndex].length) {
-            DEBUG_PRINT("E: Byte index out of bounds");
+            DEBUG_PRINT(F("E: Byte index out of bounds"));
             DEBUG_PRINT(byteIndex);
-            DEBUG_PRINT("/");
+            DEBUG_PRINT(F("/"));
             DEBUG_PRINTLN(_routineMetaList[routineIndex].length);
             return false;
         }
@@ -193,9 +428,9 @@ namespace DATA {
     }
 
     void initializeEEPROM() {
-        DEBUG_PRINTLN("Initialize EEPROM");
+        DEBUG_PRINTLN(F("Initialize EEPROM"));
 
-        DEBUG_PRINT("Clearing EEPROM: ");
+        DEBUG_PRINT(F("Clearing EEPROM: "));
         for (uint16_t i = 0; i < EEPROM.length(); i++) {
             EEPROM.write(i, DEFAULT_EEPROM_VALUE);
 
@@ -204,48 +439,52 @@ namespace DATA {
             }
         }
         DEBUG_PRINTLN();
-        DEBUG_PRINTLN("Cleared EEPROM");
+        DEBUG_PRINTLN(F("Cleared EEPROM"));
 
         EEPROM.write(META_DATA_VERSION_OFFSET, MAX_SUPPORTED_DATA_VERSION);
-        DEBUG_PRINTLN("Cleared meta");
+        DEBUG_PRINTLN(F("Cleared meta"));
 
         for (int i = DEFAULT_PIN_STATES_OFFSET; i < DEFAULT_PIN_STATES_OFFSET + DEFAULT_PIN_STATES_SIZE; i++) {
             EEPROM.write(i, 0b00000000);
         }
-        DEBUG_PRINTLN("Cleared default pin states");
+        DEBUG_PRINTLN(F("Cleared default pin states"));
 
         EEPROM.write(ROUTINE_COUNT_OFFSET, 0);
-        DEBUG_PRINTLN("Cleared routine count");
+        DEBUG_PRINTLN(F("Cleared routine count"));
 
         delete _meta;
         _meta = nullptr;
-        DEBUG_PRINTLN("Cleared meta object");
+        DEBUG_PRINTLN(F("Cleared meta object"));
 
         for (int i = 0; i < CONFIG_MAX_ROUTINES; i++) {
             _routineMetaList[i].buttonPin = 0;
             _routineMetaList[i].length = 0;
+            _routineMetaList[i].retriggerPolicy = 0;
+            _routineMetaList[i].retriggerDepth = 0;
+            _routineMetaList[i].priority = 0;
+            _routineMetaList[i].source = SOURCE_EEPROM;
             _routineOffsetList[i] = 0;
         }
-        DEBUG_PRINTLN("Cleared routine meta list");
+        DEBUG_PRINTLN(F("Cleared routine meta list"));
 
         readMeta();
-        DEBUG_PRINTLN("Reconstructed meta object");
+        DEBUG_PRINTLN(F("Reconstructed meta object"));
 
-        DEBUG_PRINTLN("Initialize EEPROM done");
+        DEBUG_PRINTLN(F("Initialize EEPROM done"));
     }
 
     void factoryReset() {
-        DEBUG_PRINTLN("Factory reset");
+        DEBUG_PRINTLN(F("Factory reset"));
 
         for (uint16_t i = 0; i < EEPROM.length(); i++) {
             EEPROM.write(i, DEFAULT_EEPROM_VALUE);
 
             DEBUG_PRINT(i + 1);
-            DEBUG_PRINT("/");
+            DEBUG_PRINT(F("/"));
             DEBUG_PRINTLN(EEPROM.length());
         }
 
-        DEBUG_PRINTLN("Factory reset done");
+        DEBUG_PRINTLN(F("Factory reset done"));
     }
 
     void dump() {
@@ -253,9 +492,9 @@ namespace DATA {
         for (unsigned int i = 0; i < EEPROM.length(); i++) {
             sprintf(buffer, "%02X", EEPROM.read(i));
             Serial.print(buffer);
-            Serial.print(" ");
+            Serial.print(F(" "));
         }
         Serial.println();
-        Serial.println("Done");
+        Serial.println(F("Done"));
     }
 }
\ No newline at end of file
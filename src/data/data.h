@@ -4,11 +4,21 @@
 #include <Arduino.h>
 
 namespace DATA {
-    const uint8_t MAX_SUPPORTED_DATA_VERSION = 0x01;
+    const uint8_t MAX_SUPPORTED_DATA_VERSION = 0x04;
+
+    // Routine slots either run their own bytes from EEPROM or LIBRARY routine (source - 1) from flash
+    const uint8_t SOURCE_EEPROM = 0x00;
+
+    // Pin sets are bitmaps with one bit per digital pin
+    const uint8_t PIN_BITMAP_SIZE = (NUM_DIGITAL_PINS + 7) / 8;
 
     struct RoutineMeta {
         uint8_t buttonPin;
         uint16_t length;
+        uint8_t retriggerPolicy; // ROUTINE::RETRIGGER_*
+        uint8_t retriggerDepth; // Queued triggers kept for RETRIGGER_QUEUE, 0 uses the whole queue
+        uint8_t priority; // Scheduling class, 0 is served first
+        uint8_t source; // SOURCE_EEPROM or library routine index + 1
     };
 
     struct Meta {
@@ -22,6 +32,9 @@ namespace DATA {
 
     Meta* readMeta();
     void writeMeta();
+    bool readDefaultPinStates(uint8_t *defaultPinStates);
+    uint8_t readButtonPins(uint8_t *buttonPins);
+    void readRoutinePins(uint8_t *waitPins, uint8_t *drivenPins);
     uint8_t readRoutineByte(unsigned int routineIndex, uint16_t byteIndex);
     bool writeRoutineByte(unsigned int routineIndex, uint16_t byteIndex, uint8_t value);
 
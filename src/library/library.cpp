@@ -0,0 +1,52 @@
+#include "library/library.h"
+#include <Arduino.h>
+
+// Routines compiled into the firmware. A routine slot runs one of these when its source is set
+// to the routine's position in _routines plus one.
+
+LIBRARY_ROUTINE(_strobe,
+    LIBRARY_PULSE_TRAIN(13, 10, 500, 500),
+    LIBRARY_PULSE_WAIT(13),
+    LIBRARY_HALT());
+
+LIBRARY_ROUTINE(_armedSequence,
+    LIBRARY_PIN_HIGH(12),
+    LIBRARY_WAIT_PIN_HIGH(7, 5000, 14),
+    LIBRARY_PIN_HIGH(11),
+    LIBRARY_DELAY(1),
+    LIBRARY_PIN_LOW(11),
+    LIBRARY_PIN_LOW(12),
+    LIBRARY_HALT());
+
+namespace LIBRARY {
+    struct Routine {
+        const uint8_t *bytes;
+        uint16_t length;
+    };
+
+    const Routine _routines[] PROGMEM = {
+        { _strobe, sizeof(_strobe) },
+        { _armedSequence, sizeof(_armedSequence) },
+    };
+
+    uint8_t count() {
+        return sizeof(_routines) / sizeof(_routines[0]);
+    }
+
+    uint16_t length(uint8_t routineId) {
+        if (routineId >= count()) {
+            return 0;
+        }
+
+        return pgm_read_word(&_routines[routineId].length);
+    }
+
+    uint8_t readByte(uint8_t routineId, uint16_t byteIndex) {
+        if (byteIndex >= length(routineId)) {
+            return 0;
+        }
+
+        const uint8_t *bytes = (const uint8_t *)pgm_read_ptr(&_routines[routineId].bytes);
+        return pgm_read_byte(bytes + byteIndex);
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef LIBRARY_h
+#define LIBRARY_h
+
+#include "routine/routine.h"
+#include <Arduino.h>
+
+// Instruction encodings for routines compiled into flash, see ROUTINE::INSTRUCTION_*
+#define LIBRARY_HALT() ROUTINE::INSTRUCTION_HALT
+#define LIBRARY_NOP() ROUTINE::INSTRUCTION_NOP
+#define LIBRARY_PIN_LOW(pin) ROUTINE::INSTRUCTION_PIN_LOW, (pin)
+#define LIBRARY_PIN_HIGH(pin) ROUTINE::INSTRUCTION_PIN_HIGH, (pin)
+#define LIBRARY_DELAY(seconds) ROUTINE::INSTRUCTION_DELAY, (seconds)
+#define LIBRARY_WAIT_PIN_HIGH(pin, timeout, target) ROUTINE::INSTRUCTION_WAIT_PIN_HIGH, (pin), \
+    LIBRARY_WORD(timeout), LIBRARY_WORD(target)
+#define LIBRARY_WAIT_PIN_LOW(pin, timeout, target) ROUTINE::INSTRUCTION_WAIT_PIN_LOW, (pin), \
+    LIBRARY_WORD(timeout), LIBRARY_WORD(target)
+#define LIBRARY_PWM_SET(pin, duty) ROUTINE::INSTRUCTION_PWM_SET, (pin), (duty)
+#define LIBRARY_PULSE_TRAIN(pin, count, highTime, lowTime) ROUTINE::INSTRUCTION_PULSE_TRAIN, (pin), \
+    LIBRARY_WORD(count), LIBRARY_WORD(highTime), LIBRARY_WORD(lowTime)
+#define LIBRARY_PULSE_WAIT(pin) ROUTINE::INSTRUCTION_PULSE_WAIT, (pin)
+
+#define LIBRARY_WORD(value) (((value) >> 8) & 0xFF), ((value) & 0xFF)
+
+// Defines a routine in flash and rejects it at compile time unless it decodes into whole instructions
+// and every wait branches to the start of an instruction
+#define LIBRARY_ROUTINE(name, ...) \
+    constexpr uint8_t name[] PROGMEM = { __VA_ARGS__ }; \
+    static_assert(LIBRARY::validate(name), "Invalid library routine: " #name)
+
+namespace LIBRARY {
+    constexpr bool _isInstructionStart(const uint8_t *bytes, uint16_t length, uint16_t index, uint16_t target) {
+        return index == target ? true
+            : index > target || index >= length ? false
+            : ROUTINE::instructionLength(bytes[index]) == 0 ? false
+            : _isInstructionStart(bytes, length, index + ROUTINE::instructionLength(bytes[index]), target);
+    }
+
+    constexpr bool _isWait(uint8_t instruction) {
+        return instruction == ROUTINE::INSTRUCTION_WAIT_PIN_HIGH || instruction == ROUTINE::INSTRUCTION_WAIT_PIN_LOW;
+    }
+
+    constexpr bool _validate(const uint8_t *bytes, uint16_t length, uint16_t index) {
+        return index == length ? true
+            : ROUTINE::instructionLength(bytes[index]) == 0 ? false
+            : index + ROUTINE::instructionLength(bytes[index]) > length ? false
+            : _isWait(bytes[index]) && !_isInstructionStart(bytes, length, 0, bytes[index + 4] << 8 | bytes[index + 5]) ? false
+            : _validate(bytes, length, index + ROUTINE::instructionLength(bytes[index]));
+    }
+
+    template<size_t length>
+    constexpr bool validate(const uint8_t (&bytes)[length]) {
+        return length <= 0xFFFF && _validate(bytes, length, 0);
+    }
+
+    uint8_t count();
+    uint16_t length(uint8_t routineId);
+    uint8_t readByte(uint8_t routineId, uint16_t byteIndex);
+}
+
+#endif
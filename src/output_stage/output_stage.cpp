@@ -0,0 +1,128 @@
+#include "output_stage/output_stage.h"
+#include "config.h"
+#include "trace/trace.h"
+#include <Arduino.h>
+
+// Arduino cores number ports from PA (1) to PL (12), 0 is NOT_A_PORT
+const uint8_t PORT_COUNT = 13;
+
+namespace OUTPUT_STAGE {
+    uint8_t _setMasks[PORT_COUNT];
+    uint8_t _clearMasks[PORT_COUNT];
+    uint8_t _inputMasks[PORT_COUNT];
+    uint8_t _outputMasks[PORT_COUNT];
+    uint16_t _dirtyPorts = 0;
+    uint8_t _owners[NUM_DIGITAL_PINS];
+
+    volatile uint16_t _conflicts = 0;
+
+    void stage(uint8_t pin, uint8_t state, uint8_t owner) {
+        uint8_t port = pin < NUM_DIGITAL_PINS ? digitalPinToPort(pin) : NOT_A_PORT;
+        if (port == NOT_A_PORT || port >= PORT_COUNT) {
+            return;
+        }
+
+        uint8_t mask = digitalPinToBitMask(pin);
+        uint8_t *stageMasks = state == LOW ? _clearMasks : _setMasks;
+        uint8_t *otherMasks = state == LOW ? _setMasks : _clearMasks;
+
+        if ((otherMasks[port] & mask) && _owners[pin] != owner) {
+            _conflicts++;
+#if CONFIG_OUTPUT_CONFLICT_POLICY == CONFIG_OUTPUT_CONFLICT_LOW_WINS
+            if (state != LOW) {
+                return;
+            }
+#elif CONFIG_OUTPUT_CONFLICT_POLICY == CONFIG_OUTPUT_CONFLICT_HIGH_WINS
+            if (state == LOW) {
+                return;
+            }
+#endif
+        }
+
+        otherMasks[port] &= ~mask;
+        stageMasks[port] |= mask;
+        _owners[pin] = owner;
+        _dirtyPorts |= 1 << port;
+    }
+
+    void commit() {
+        if (_dirtyPorts == 0) {
+            return;
+        }
+
+#if CONFIG_TRACE == true
+        // Edges are traced as written, writes that lost a conflict or target an input never happen
+        for (uint8_t pin = 0; pin < NUM_DIGITAL_PINS; pin++) {
+            uint8_t port = digitalPinToPort(pin);
+            uint8_t mask = digitalPinToBitMask(pin);
+            if (_owners[pin] == NO_OWNER || (_inputMasks[port] & mask)) {
+                continue;
+            }
+
+            if (_setMasks[port] & mask) {
+                TRACE::record(_owners[pin], TRACE::EVENT_PIN_HIGH, pin);
+            } else if (_clearMasks[port] & mask) {
+                TRACE::record(_owners[pin], TRACE::EVENT_PIN_LOW, pin);
+            }
+        }
+#endif
+
+        for (uint8_t port = 1; port < PORT_COUNT; port++) {
+            if (!(_dirtyPorts & (1 << port))) {
+                continue;
+            }
+
+            volatile uint8_t *out = portOutputRegister(port);
+            volatile uint8_t *mode = portModeRegister(port);
+            uint8_t driven = (_setMasks[port] | _clearMasks[port]) & ~_inputMasks[port];
+
+            // Level first, so a pin switched to output starts at its staged state; on other pins it sets the pull-up
+            uint8_t oldSREG = SREG;
+            cli();
+            *out = (*out & ~(_clearMasks[port] & driven)) | (_setMasks[port] & driven);
+            *mode |= driven & _outputMasks[port];
+            SREG = oldSREG;
+
+            _setMasks[port] = 0;
+            _clearMasks[port] = 0;
+        }
+
+        _dirtyPorts = 0;
+    }
+
+    void clearReservations() {
+        for (uint8_t port = 0; port < PORT_COUNT; port++) {
+            _inputMasks[port] = 0;
+            _outputMasks[port] = 0;
+        }
+
+        reserveInput(0);
+        reserveInput(1);
+    }
+
+    void reserveInput(uint8_t pin) {
+        uint8_t port = pin < NUM_DIGITAL_PINS ? digitalPinToPort(pin) : NOT_A_PORT;
+        if (port == NOT_A_PORT || port >= PORT_COUNT) {
+            return;
+        }
+
+        _inputMasks[port] |= digitalPinToBitMask(pin);
+    }
+
+    void reserveOutput(uint8_t pin) {
+        uint8_t port = pin < NUM_DIGITAL_PINS ? digitalPinToPort(pin) : NOT_A_PORT;
+        if (port == NOT_A_PORT || port >= PORT_COUNT) {
+            return;
+        }
+
+        _outputMasks[port] |= digitalPinToBitMask(pin);
+    }
+
+    uint16_t conflicts() {
+        uint8_t oldSREG = SREG;
+        cli();
+        uint16_t result = _conflicts;
+        SREG = oldSREG;
+        return result;
+    }
+}
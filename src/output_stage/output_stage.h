@@ -0,0 +1,24 @@
+#ifndef OUTPUT_STAGE_h
+#define OUTPUT_STAGE_h
+
+#include <Arduino.h>
+
+namespace OUTPUT_STAGE {
+    // Owner of writes that do not come from a routine
+    const uint8_t NO_OWNER = 0xFF;
+
+    // Writes from the same owner to a pin in one pass replace each other, writes from different owners conflict
+    void stage(uint8_t pin, uint8_t state, uint8_t owner);
+    // Writes the staged levels, only pins reserved as outputs are switched to output mode and pins reserved as
+    // inputs are never touched
+    void commit();
+
+    // Drops all reserved pins except D0/D1, which carry Serial and stay inputs
+    void clearReservations();
+    void reserveInput(uint8_t pin);
+    void reserveOutput(uint8_t pin);
+
+    uint16_t conflicts();
+}
+
+#endif
@@ -0,0 +1,208 @@
+#include "pulse/pulse.h"
+#include "config.h"
+#include "utils/utils.h"
+#include <Arduino.h>
+
+// Timer1 free-runs with a /64 prescaler, 4us per count at 16MHz
+const uint32_t TICKS_PER_UNIT = F_CPU / 64UL / (1000000UL / PULSE::TIME_UNIT_US);
+const uint8_t CHANNEL_COUNT = 2;
+const uint8_t NO_PIN = 0xFF;
+const uint8_t PWM_PIN_BYTES = (NUM_DIGITAL_PINS + 7) / 8;
+
+namespace PULSE {
+    struct Channel {
+        uint8_t pin;
+        volatile uint8_t *out;
+        uint8_t bitMask;
+        bool high;
+        uint16_t pulses;
+        uint32_t highTicks;
+        uint32_t lowTicks;
+        uint32_t remainingTicks;
+    };
+
+    volatile Channel _channels[CHANNEL_COUNT];
+    uint8_t _pwmPins[PWM_PIN_BYTES];
+    volatile bool _trainStopped = false;
+
+    bool _isPwm(uint8_t pin);
+    void _stopChannel(uint8_t channel);
+    void _schedule(uint8_t channel, bool fromNow);
+
+    void setup() {
+        DEBUG_PRINTLN(F("Pulse setup"));
+
+        uint8_t oldSREG = SREG;
+        cli();
+        TCCR1A = 0;
+        TCCR1B = _BV(CS11) | _BV(CS10);
+        TIMSK1 = 0;
+        SREG = oldSREG;
+
+        for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+            _channels[i].pin = NO_PIN;
+        }
+        for (uint8_t i = 0; i < PWM_PIN_BYTES; i++) {
+            _pwmPins[i] = 0;
+        }
+
+        DEBUG_PRINTLN(F("Pulse setup done"));
+    }
+
+    bool setPwm(uint8_t pin, uint8_t duty) {
+        if (!validatePwmPin(pin)) {
+            return false;
+        }
+
+        release(pin);
+        analogWrite(pin, duty);
+        _pwmPins[pin / 8] |= _BV(pin % 8);
+        return true;
+    }
+
+    bool startTrain(uint8_t pin, uint16_t count, uint16_t highTime, uint16_t lowTime) {
+        if (pin >= NUM_DIGITAL_PINS || digitalPinToPort(pin) == NOT_A_PORT) {
+            return false;
+        }
+
+        release(pin);
+
+        uint8_t channel = 0;
+        while (channel < CHANNEL_COUNT && _channels[channel].pin != NO_PIN) {
+            channel++;
+        }
+        if (channel == CHANNEL_COUNT) {
+            return false;
+        }
+
+        pinMode(pin, OUTPUT);
+
+        uint8_t oldSREG = SREG;
+        cli();
+        volatile Channel &c = _channels[channel];
+        c.pin = pin;
+        c.out = portOutputRegister(digitalPinToPort(pin));
+        c.bitMask = digitalPinToBitMask(pin);
+        c.pulses = count;
+        c.highTicks = (highTime > 0 ? highTime : 1) * TICKS_PER_UNIT;
+        c.lowTicks = (lowTime > 0 ? lowTime : 1) * TICKS_PER_UNIT;
+        c.high = true;
+        c.remainingTicks = c.highTicks;
+        *c.out |= c.bitMask;
+        _schedule(channel, true);
+        SREG = oldSREG;
+
+        return true;
+    }
+
+    bool trainActive(uint8_t pin) {
+        for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+            if (_channels[i].pin == pin) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool takeTrainStops() {
+        uint8_t oldSREG = SREG;
+        cli();
+        bool result = _trainStopped;
+        _trainStopped = false;
+        SREG = oldSREG;
+        return result;
+    }
+
+    void release(uint8_t pin) {
+        for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+            if (_channels[i].pin == pin) {
+                uint8_t oldSREG = SREG;
+                cli();
+                _stopChannel(i);
+                SREG = oldSREG;
+            }
+        }
+
+        if (_isPwm(pin)) {
+            // digitalWrite is what disconnects the timer from the pin, it keeps the level the timer drove last
+            bool level = *portInputRegister(digitalPinToPort(pin)) & digitalPinToBitMask(pin);
+            digitalWrite(pin, level ? HIGH : LOW);
+            _pwmPins[pin / 8] &= ~_BV(pin % 8);
+        }
+    }
+
+    void stopAll() {
+        // Unlike a release from a routine, stopping the engine leaves every pulse and PWM pin low
+        for (uint8_t pin = 0; pin < NUM_DIGITAL_PINS; pin++) {
+            if (trainActive(pin) || _isPwm(pin)) {
+                release(pin);
+                digitalWrite(pin, LOW);
+            }
+        }
+    }
+
+    bool _isPwm(uint8_t pin) {
+        return pin < NUM_DIGITAL_PINS && (_pwmPins[pin / 8] & _BV(pin % 8));
+    }
+
+    void _stopChannel(uint8_t channel) {
+        // A finished train already ended low, a released one keeps its level for the output stage to write
+        TIMSK1 &= channel == 0 ? ~_BV(OCIE1A) : ~_BV(OCIE1B);
+        _channels[channel].pin = NO_PIN;
+        _trainStopped = true;
+    }
+
+    void _schedule(uint8_t channel, bool fromNow) {
+        volatile Channel &c = _channels[channel];
+        uint16_t step = c.remainingTicks > 0xFFFF ? 0xFFFF : c.remainingTicks;
+        c.remainingTicks -= step;
+
+        if (channel == 0) {
+            OCR1A = (fromNow ? TCNT1 : OCR1A) + step;
+            if (fromNow) {
+                TIFR1 = _BV(OCF1A);
+                TIMSK1 |= _BV(OCIE1A);
+            }
+        } else {
+            OCR1B = (fromNow ? TCNT1 : OCR1B) + step;
+            if (fromNow) {
+                TIFR1 = _BV(OCF1B);
+                TIMSK1 |= _BV(OCIE1B);
+            }
+        }
+    }
+
+    void _service(uint8_t channel) {
+        volatile Channel &c = _channels[channel];
+        if (c.remainingTicks > 0) {
+            _schedule(channel, false);
+            return;
+        }
+
+        if (c.high) {
+            *c.out &= ~c.bitMask;
+            c.high = false;
+            c.remainingTicks = c.lowTicks;
+
+            // A count of 0 keeps the train running until the pin is released
+            if (c.pulses > 0 && --c.pulses == 0) {
+                _stopChannel(channel);
+                return;
+            }
+        } else {
+            *c.out |= c.bitMask;
+            c.high = true;
+            c.remainingTicks = c.highTicks;
+        }
+
+        _schedule(channel, false);
+    }
+}
+
+ISR(TIMER1_COMPA_vect) {
+    PULSE::_service(0);
+}
+
+ISR(TIMER1_COMPB_vect) {
+    PULSE::_service(1);
+}
@@ -0,0 +1,22 @@
+#ifndef PULSE_h
+#define PULSE_h
+
+#include <Arduino.h>
+
+namespace PULSE {
+    // Pulse train times are given in units of 100us
+    const uint16_t TIME_UNIT_US = 100;
+
+    void setup();
+
+    bool setPwm(uint8_t pin, uint8_t duty);
+    bool startTrain(uint8_t pin, uint16_t count, uint16_t highTime, uint16_t lowTime);
+    bool trainActive(uint8_t pin);
+    // Whether a train stopped since the last call, finished or released
+    bool takeTrainStops();
+    // Stops a train or PWM on the pin without changing its level, the next write sets it
+    void release(uint8_t pin);
+    void stopAll();
+}
+
+#endif
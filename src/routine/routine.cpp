@@ -1,145 +1,840 @@
 #include "routine.h"
+#include "boot/boot.h"
 #include "data/data.h"
+#include "library/library.h"
+#include "output_stage/output_stage.h"
+#include "pulse/pulse.h"
+#include "trace/trace.h"
 #include "config.h"
 #include "utils/utils.h"
 #include <Arduino.h>
 
-#define read(routineIndex, index) DATA::readRoutineByte(routineIndex, index); \
+#if CONFIG_ROUTINE_TICK_ISR == true
+    // Serial output relies on interrupts and would stall the tick, keep the interpreter silent
+    #define ROUTINE_DEBUG_PRINT(...)
+    #define ROUTINE_DEBUG_PRINTLN(...)
+#else
+    #define ROUTINE_DEBUG_PRINT(...) DEBUG_PRINT(__VA_ARGS__)
+    #define ROUTINE_DEBUG_PRINTLN(...) DEBUG_PRINTLN(__VA_ARGS__)
+#endif
+
+#define ROUTINE_TICK_CYCLES ((F_CPU / 1000000UL) * CONFIG_ROUTINE_TICK_US)
+#if ROUTINE_TICK_CYCLES <= 256UL
+    #define ROUTINE_TICK_PRESCALER 1UL
+    #define ROUTINE_TICK_CLOCK_SELECT (_BV(CS20))
+#elif ROUTINE_TICK_CYCLES <= 2048UL
+    #define ROUTINE_TICK_PRESCALER 8UL
+    #define ROUTINE_TICK_CLOCK_SELECT (_BV(CS21))
+#elif ROUTINE_TICK_CYCLES <= 8192UL
+    #define ROUTINE_TICK_PRESCALER 32UL
+    #define ROUTINE_TICK_CLOCK_SELECT (_BV(CS21) | _BV(CS20))
+#elif ROUTINE_TICK_CYCLES <= 16384UL
+    #define ROUTINE_TICK_PRESCALER 64UL
+    #define ROUTINE_TICK_CLOCK_SELECT (_BV(CS22))
+#elif ROUTINE_TICK_CYCLES <= 32768UL
+    #define ROUTINE_TICK_PRESCALER 128UL
+    #define ROUTINE_TICK_CLOCK_SELECT (_BV(CS22) | _BV(CS20))
+#elif ROUTINE_TICK_CYCLES <= 65536UL
+    #define ROUTINE_TICK_PRESCALER 256UL
+    #define ROUTINE_TICK_CLOCK_SELECT (_BV(CS22) | _BV(CS21))
+#elif ROUTINE_TICK_CYCLES <= 262144UL
+    #define ROUTINE_TICK_PRESCALER 1024UL
+    #define ROUTINE_TICK_CLOCK_SELECT (_BV(CS22) | _BV(CS21) | _BV(CS20))
+#else
+    #error "CONFIG_ROUTINE_TICK_US is too long for Timer2"
+#endif
+
+#define read(routineIndex, index) _readByte(routineIndex, index); \
     index++;
 
+const uint16_t IMAGE_NOT_LOADED = 0xFFFF;
+
+static_assert(CONFIG_BUTTON_DEBOUNCE_US <= 0xFFFF, "CONFIG_BUTTON_DEBOUNCE_US must fit in 16 bits");
+
+const uint8_t WAIT_ACTIVE = 0x01;
+const uint8_t WAIT_HIGH = 0x02;
+const uint8_t WAIT_TIMED = 0x04;
+const uint8_t WAIT_PULSE = 0x08;
+// Pins without a pin change interrupt are checked on every pass
+const uint8_t WAIT_POLL = 0xFF;
+// Pulse train waits are checked on the pass after any train stopped
+const uint8_t WAIT_PULSE_GROUP = 0x80;
+
 namespace ROUTINE {
+    DATA::Meta *_meta = nullptr;
+    bool _running = false;
+
     long _timers[CONFIG_MAX_ROUTINES];
     int _indices[CONFIG_MAX_ROUTINES];
+    bool _deadlineArmed[CONFIG_MAX_ROUTINES];
+
+#if CONFIG_ROUTINE_TICK_ISR == true
+    // The tick cannot read EEPROM, so it executes from a RAM copy
+    uint8_t _image[CONFIG_ROUTINE_IMAGE_SIZE];
+    uint16_t _imageOffsets[CONFIG_MAX_ROUTINES];
+#endif
+
+    uint8_t _buttonPorts[CONFIG_MAX_ROUTINES];
+    uint8_t _buttonBitMasks[CONFIG_MAX_ROUTINES];
+
+    uint8_t _waitFlags[CONFIG_MAX_ROUTINES];
+    uint16_t _waitTargets[CONFIG_MAX_ROUTINES];
+    uint8_t _waitPins[CONFIG_MAX_ROUTINES];
+    uint8_t _waitGroups[CONFIG_MAX_ROUTINES];
+
+    // One bit per pin change interrupt group, set from the PCINT vectors
+    volatile uint8_t _pinChanges = 0;
+    uint8_t _passPinChanges = 0;
+
+    bool _buttonLevels[CONFIG_MAX_ROUTINES]; // Debounced
+    uint16_t _buttonDebounceTimers[CONFIG_MAX_ROUTINES];
+    uint16_t _triggerQueues[CONFIG_MAX_ROUTINES][CONFIG_TRIGGER_QUEUE_SIZE];
+    uint8_t _triggerQueueHeads[CONFIG_MAX_ROUTINES];
+    uint8_t _triggerQueueCounts[CONFIG_MAX_ROUTINES];
 
-    void _runRoutine(uint8_t routineIndex, DATA::Meta *meta, unsigned long delta);
-    void _detectButtonPress(int routineIndex, DATA::Meta *meta);
+    uint16_t _budgetExhaustions[CONFIG_MAX_ROUTINES];
+    uint16_t _passDeferrals[CONFIG_MAX_ROUTINES];
+    uint16_t _droppedTriggers[CONFIG_MAX_ROUTINES];
+    uint16_t _coalescedTriggers[CONFIG_MAX_ROUTINES];
+    uint16_t _maxTriggerLatencies[CONFIG_MAX_ROUTINES];
+    uint16_t _missedDeadlines[CONFIG_MAX_ROUTINES];
+
+    volatile uint16_t _tickOverruns = 0;
+
+#if CONFIG_ROUTINE_TICK_ISR == true
+    void _loadImage();
+#endif
+    bool _isLoaded(uint8_t routineIndex);
+    uint8_t _readByte(uint8_t routineIndex, uint16_t byteIndex);
+    void _runPass(unsigned long delta);
+    bool _advanceRoutine(uint8_t routineIndex, unsigned long delta);
+    bool _runsBefore(uint8_t routineIndex, uint8_t otherIndex);
+    void _runRoutine(uint8_t routineIndex, DATA::Meta *meta, uint16_t& passBudget);
+    bool _runInstruction(uint8_t routineIndex);
+    bool _wait(uint8_t routineIndex, uint8_t pin, bool high, uint16_t timeout, uint16_t target);
+    bool _waitPulse(uint8_t routineIndex, uint8_t pin);
+    bool _resumeWait(uint8_t routineIndex, unsigned long delta);
+    void _endWait(uint8_t routineIndex);
+    void _disarmPin(uint8_t pin);
+    void _takePinChanges();
+    bool _readPin(uint8_t pin);
+    void _detectButtonPress(int routineIndex, DATA::Meta *meta, unsigned long delta);
+    void _startRoutine(uint8_t routineIndex);
+    void _queueTrigger(uint8_t routineIndex, DATA::RoutineMeta *routineMeta);
+    void _startTick();
+    void _stopTick();
 
     void setup() {
-        DEBUG_PRINTLN("Routine setup");
+        DEBUG_PRINTLN(F("Routine setup"));
+
+        DATA::readMeta();
+
+        PULSE::setup();
+
+        DEBUG_PRINT(F("Default pin states applied at boot after "));
+        DEBUG_PRINT(BOOT::safeStateMicros());
+        DEBUG_PRINTLN(F("us"));
+
+        start();
 
-        DATA::Meta *meta = DATA::readMeta();
+        DEBUG_PRINTLN(F("Routine setup done"));
+    }
+
+    void start() {
+        DEBUG_PRINTLN(F("Routine start"));
+
+        _stopTick();
+        _running = false;
+
+        _meta = DATA::readMeta();
 
-        for (int i = 0; i < meta->routineCount; i++) {
-            DATA::RoutineMeta *routineMeta = &meta->routineMetaList[i];
+        OUTPUT_STAGE::clearReservations();
+        for (int i = 0; i < _meta->routineCount; i++) {
+            DATA::RoutineMeta *routineMeta = &_meta->routineMetaList[i];
             pinMode(routineMeta->buttonPin, INPUT);
+            OUTPUT_STAGE::reserveInput(routineMeta->buttonPin);
+            _buttonPorts[i] = digitalPinToPort(routineMeta->buttonPin);
+            _buttonBitMasks[i] = digitalPinToBitMask(routineMeta->buttonPin);
 
-            DEBUG_PRINT("Routine ");
+            DEBUG_PRINT(F("Routine "));
             DEBUG_PRINT(i);
-            DEBUG_PRINT(" button pin: ");
+            DEBUG_PRINT(F(" button pin: "));
             DEBUG_PRINTLN(routineMeta->buttonPin);
         }
 
-        DEBUG_PRINTLN("Setting default pin states");
-        for (int i = 0; i < 32; i++) {
-            uint8_t pinByte = meta->defaultPinStates[i];
-            for (int j = 0; j < 8; j++) {
-                if (!validatePin(i * 8 + j)) {
-                    continue;
-                }
-                
-                uint8_t pinState = (pinByte >> j) & 0x01;
-                digitalWrite(i * 8 + j, pinState);
-
-                DEBUG_PRINT("Pin ");
-                DEBUG_PRINT(i * 8 + j);
-                DEBUG_PRINT(" state: ");
-                DEBUG_PRINTLN(pinState);
+        // Waits sample their pin, so it is never driven as an output even if a routine also writes it
+        uint8_t waitPins[DATA::PIN_BITMAP_SIZE];
+        uint8_t drivenPins[DATA::PIN_BITMAP_SIZE];
+        DATA::readRoutinePins(waitPins, drivenPins);
+        for (uint8_t pin = 0; pin < NUM_DIGITAL_PINS; pin++) {
+            if (waitPins[pin / 8] & _BV(pin % 8)) {
+                pinMode(pin, INPUT);
+                OUTPUT_STAGE::reserveInput(pin);
+            } else if (drivenPins[pin / 8] & _BV(pin % 8)) {
+                OUTPUT_STAGE::reserveOutput(pin);
             }
         }
 
-        DEBUG_PRINTLN("Initializing timers and indices");
+#if CONFIG_ROUTINE_TICK_ISR == true
+        _loadImage();
+#endif
+
+        DEBUG_PRINTLN(F("Initializing timers and indices"));
         for (int i = 0; i < CONFIG_MAX_ROUTINES; i++) {
             _timers[i] = 0;
             _indices[i] = -1;
+            _endWait(i);
+            _buttonLevels[i] = false;
+            _buttonDebounceTimers[i] = 0;
+            _triggerQueueHeads[i] = 0;
+            _triggerQueueCounts[i] = 0;
+            _budgetExhaustions[i] = 0;
+            _passDeferrals[i] = 0;
+            _droppedTriggers[i] = 0;
+            _coalescedTriggers[i] = 0;
+            _maxTriggerLatencies[i] = 0;
+            _missedDeadlines[i] = 0;
+            _deadlineArmed[i] = false;
+        }
+
+        _running = true;
+        _startTick();
+
+        DEBUG_PRINTLN(F("Routine start done"));
+    }
+
+    void stop() {
+        DEBUG_PRINTLN(F("Routine stop"));
+
+        _stopTick();
+        _running = false;
+
+        for (int i = 0; i < CONFIG_MAX_ROUTINES; i++) {
+            _indices[i] = -1;
+            _endWait(i);
+            _triggerQueueCounts[i] = 0;
         }
 
-        DEBUG_PRINTLN("Routine setup done");
+        PULSE::stopAll();
     }
 
     void loop(unsigned long delta) {
-        DATA::Meta *meta = DATA::readMeta();
+#if CONFIG_ROUTINE_TICK_ISR == false
+        if (!_running) {
+            return;
+        }
+
+        _runPass(delta * 1000UL);
+#endif
+    }
+
+    void tick() {
+        _runPass(CONFIG_ROUTINE_TICK_US);
+    }
+
+    void printStats() {
+        uint8_t oldSREG = SREG;
+        cli();
+        uint16_t tickOverruns = _tickOverruns;
+        SREG = oldSREG;
+
+        Serial.print(F("Safe state after reset: "));
+        Serial.print(BOOT::safeStateMicros());
+        Serial.println(F("us"));
+        Serial.print(F("Tick: "));
+        Serial.print(CONFIG_ROUTINE_TICK_ISR ? CONFIG_ROUTINE_TICK_US : 0);
+        Serial.println(F("us"));
+        Serial.print(F("Tick overruns: "));
+        Serial.println(tickOverruns);
+        Serial.print(F("Output conflicts: "));
+        Serial.println(OUTPUT_STAGE::conflicts());
+
+        for (int i = 0; i < _meta->routineCount; i++) {
+            // Counters are copied one routine at a time to keep the stack small
+            oldSREG = SREG;
+            cli();
+            uint16_t budgetExhaustions = _budgetExhaustions[i];
+            uint16_t passDeferrals = _passDeferrals[i];
+            uint16_t droppedTriggers = _droppedTriggers[i];
+            uint16_t coalescedTriggers = _coalescedTriggers[i];
+            uint16_t maxTriggerLatency = _maxTriggerLatencies[i];
+            uint16_t missedDeadlines = _missedDeadlines[i];
+            SREG = oldSREG;
+
+            Serial.print(F("Routine "));
+            Serial.print(i);
+            Serial.print(F(" image: "));
+            if (_meta->routineMetaList[i].source != DATA::SOURCE_EEPROM) {
+                Serial.print(F("flash "));
+                Serial.print(_meta->routineMetaList[i].source - 1);
+            } else {
+#if CONFIG_ROUTINE_TICK_ISR == true
+                Serial.print(_isLoaded(i) ? F("RAM") : F("not loaded"));
+#else
+                Serial.print(F("EEPROM"));
+#endif
+            }
+            Serial.print(F(" budget exhausted: "));
+            Serial.print(budgetExhaustions);
+            Serial.print(F(" deferred: "));
+            Serial.print(passDeferrals);
+            Serial.print(F(" dropped: "));
+            Serial.print(droppedTriggers);
+            Serial.print(F(" coalesced: "));
+            Serial.print(coalescedTriggers);
+            Serial.print(F(" max queued: "));
+            Serial.print(maxTriggerLatency);
+            Serial.print(F("ms priority: "));
+            Serial.print(_meta->routineMetaList[i].priority);
+            Serial.print(F(" missed deadlines: "));
+            Serial.println(missedDeadlines);
+        }
+    }
+
+#if CONFIG_ROUTINE_TICK_ISR == true
+    void _loadImage() {
+        DEBUG_PRINTLN(F("Loading routine image"));
+
+        uint16_t offset = 0;
+        for (int i = 0; i < CONFIG_MAX_ROUTINES; i++) {
+            _imageOffsets[i] = IMAGE_NOT_LOADED;
+            if (i >= _meta->routineCount || _meta->routineMetaList[i].source != DATA::SOURCE_EEPROM) {
+                continue;
+            }
+
+            uint16_t length = _meta->routineMetaList[i].length;
+            if (length > CONFIG_ROUTINE_IMAGE_SIZE - offset) {
+                // Not debug only, the routine stays disabled until the image is made to fit
+                Serial.print(F("E: Routine "));
+                Serial.print(i);
+                Serial.println(F(" does not fit in the routine image, not loaded"));
+                continue;
+            }
+
+            for (uint16_t j = 0; j < length; j++) {
+                _image[offset + j] = DATA::readRoutineByte(i, j);
+            }
+            _imageOffsets[i] = offset;
+            offset += length;
+        }
+
+        DEBUG_PRINT(F("Routine image: "));
+        DEBUG_PRINT(offset);
+        DEBUG_PRINT(F("/"));
+        DEBUG_PRINTLN(CONFIG_ROUTINE_IMAGE_SIZE);
+    }
+#endif
+
+    bool _isLoaded(uint8_t routineIndex) {
+#if CONFIG_ROUTINE_TICK_ISR == true
+        return _meta->routineMetaList[routineIndex].source != DATA::SOURCE_EEPROM ||
+            _imageOffsets[routineIndex] != IMAGE_NOT_LOADED;
+#else
+        return true;
+#endif
+    }
+
+    uint8_t _readByte(uint8_t routineIndex, uint16_t byteIndex) {
+        if (byteIndex >= _meta->routineMetaList[routineIndex].length) {
+            return 0;
+        }
+
+        if (_meta->routineMetaList[routineIndex].source != DATA::SOURCE_EEPROM) {
+            return LIBRARY::readByte(_meta->routineMetaList[routineIndex].source - 1, byteIndex);
+        }
+
+#if CONFIG_ROUTINE_TICK_ISR == true
+        if (_imageOffsets[routineIndex] != IMAGE_NOT_LOADED) {
+            return _image[_imageOffsets[routineIndex] + byteIndex];
+        }
+
+        // EEPROM access logs over serial, which cannot be done from the tick
+        return INSTRUCTION_HALT;
+#else
+        return DATA::readRoutineByte(routineIndex, byteIndex);
+#endif
+    }
+
+    void _runPass(unsigned long delta) {
+        _takePinChanges();
+
+        // Due routines in the order they are serviced: priority class first, then earliest deadline
+        uint8_t ready[CONFIG_MAX_ROUTINES];
+        uint8_t readyCount = 0;
+        for (uint8_t routineIndex = 0; routineIndex < CONFIG_MAX_ROUTINES; routineIndex++) {
+            if (!_advanceRoutine(routineIndex, delta)) {
+                continue;
+            }
+
+            uint8_t position = readyCount++;
+            while (position > 0 && _runsBefore(routineIndex, ready[position - 1])) {
+                ready[position] = ready[position - 1];
+                position--;
+            }
+            ready[position] = routineIndex;
+        }
+
+        uint16_t passBudget = CONFIG_ROUTINE_PASS_BUDGET;
+        for (uint8_t i = 0; i < readyCount; i++) {
+            if (passBudget == 0) {
+                // Stays due, its deadline keeps counting until a later pass runs it
+                _passDeferrals[ready[i]]++;
+                continue;
+            }
+
+            _runRoutine(ready[i], _meta, passBudget);
+        }
+
         for (int routineIndex = 0; routineIndex < CONFIG_MAX_ROUTINES; routineIndex++) {
-            _runRoutine(routineIndex, meta, delta);
-            _detectButtonPress(routineIndex, meta);
+            _detectButtonPress(routineIndex, _meta, delta);
         }
+
+        OUTPUT_STAGE::commit();
     }
 
-    void _runRoutine(uint8_t routineIndex, DATA::Meta *meta, unsigned long delta) {
+    bool _advanceRoutine(uint8_t routineIndex, unsigned long delta) {
         if (_indices[routineIndex] < 0) {
-            return;
+            return false;
         }
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wsign-compare"
-        if (_indices[routineIndex] >= meta->routineMetaList[routineIndex].length) {
-#pragma GCC diagnostic pop
-            DEBUG_PRINT("Routine ");
-            DEBUG_PRINT(routineIndex);
-            DEBUG_PRINTLN(" finished");
-            _indices[routineIndex] = -1;
-            return;
+        if (_waitFlags[routineIndex] & WAIT_ACTIVE) {
+            return _resumeWait(routineIndex, delta);
         }
 
-        if (_timers[routineIndex] > 0) {
+        // Armed deadlines keep counting past zero so the timer shows how late the routine is
+        if (_timers[routineIndex] > 0 || _deadlineArmed[routineIndex]) {
             _timers[routineIndex] -= delta;
 #if CONFIG_DEBUG_ROUTINE_TIMERS == true
-            DEBUG_PRINT("Routine ");
-            DEBUG_PRINT(routineIndex);
-            DEBUG_PRINT(" timer: ");
-            DEBUG_PRINTLN(_timers[routineIndex]);
+            ROUTINE_DEBUG_PRINT(F("Routine "));
+            ROUTINE_DEBUG_PRINT(routineIndex);
+            ROUTINE_DEBUG_PRINT(F(" timer: "));
+            ROUTINE_DEBUG_PRINTLN(_timers[routineIndex]);
 #endif
-            return;
         }
 
+        return _timers[routineIndex] <= 0;
+    }
+
+    bool _runsBefore(uint8_t routineIndex, uint8_t otherIndex) {
+        uint8_t priority = _meta->routineMetaList[routineIndex].priority;
+        uint8_t otherPriority = _meta->routineMetaList[otherIndex].priority;
+        if (priority != otherPriority) {
+            return priority < otherPriority;
+        }
+
+        return _timers[routineIndex] < _timers[otherIndex];
+    }
+
+    void _runRoutine(uint8_t routineIndex, DATA::Meta *meta, uint16_t& passBudget) {
+        if (_deadlineArmed[routineIndex]) {
+            if (-_timers[routineIndex] > CONFIG_ROUTINE_DEADLINE_SLACK_US) {
+                _missedDeadlines[routineIndex]++;
+            }
+            _deadlineArmed[routineIndex] = false;
+        }
+        _timers[routineIndex] = 0;
+
+        // The end of the routine is checked first, a run that ends on its last budgeted instruction is not cut short
+        for (uint8_t executed = 0; ; executed++) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-compare"
+            if (_indices[routineIndex] >= meta->routineMetaList[routineIndex].length) {
+#pragma GCC diagnostic pop
+                ROUTINE_DEBUG_PRINT(F("Routine "));
+                ROUTINE_DEBUG_PRINT(routineIndex);
+                ROUTINE_DEBUG_PRINTLN(F(" finished"));
+                _indices[routineIndex] = -1;
+                TRACE::record(routineIndex, TRACE::EVENT_FINISH, TRACE::NO_PIN);
+                return;
+            }
+
+            // Either way the rest of the run continues on the next pass
+            if (executed == CONFIG_ROUTINE_INSTRUCTION_BUDGET) {
+                _budgetExhaustions[routineIndex]++;
+                return;
+            }
+            if (passBudget == 0) {
+                _passDeferrals[routineIndex]++;
+                return;
+            }
+
+            passBudget--;
+            if (!_runInstruction(routineIndex)) {
+                return;
+            }
+        }
+    }
+
+    bool _runInstruction(uint8_t routineIndex) {
         uint8_t instruction = read(routineIndex, _indices[routineIndex]);
-        uint8_t arg1;
+        uint8_t arg1, arg2, arg3, arg4, arg5, arg6, arg7;
         switch (instruction) {
             case INSTRUCTION_HALT:
                 _indices[routineIndex] = -1;
-                DEBUG_PRINT("Routine ");
-                DEBUG_PRINT(routineIndex);
-                DEBUG_PRINTLN(" finished");
-                break;
+                TRACE::record(routineIndex, TRACE::EVENT_FINISH, TRACE::NO_PIN);
+                ROUTINE_DEBUG_PRINT(F("Routine "));
+                ROUTINE_DEBUG_PRINT(routineIndex);
+                ROUTINE_DEBUG_PRINTLN(F(" finished"));
+                return false;
             case INSTRUCTION_PIN_LOW:
                 arg1 = read(routineIndex, _indices[routineIndex]);
-                digitalWrite(arg1, LOW);
-                break;
+                PULSE::release(arg1);
+                OUTPUT_STAGE::stage(arg1, LOW, routineIndex);
+                return true;
             case INSTRUCTION_PIN_HIGH:
                 arg1 = read(routineIndex, _indices[routineIndex]);
-                digitalWrite(arg1, HIGH);
-                break;
+                PULSE::release(arg1);
+                OUTPUT_STAGE::stage(arg1, HIGH, routineIndex);
+                return true;
             case INSTRUCTION_DELAY:
                 arg1 = read(routineIndex, _indices[routineIndex]);
-                _timers[routineIndex] = (long)arg1 * (long)1000;
-                DEBUG_PRINT("Routine ");
-                DEBUG_PRINT(routineIndex);
-                DEBUG_PRINT(" delay: ");
-                DEBUG_PRINT(arg1);
-                DEBUG_PRINT("s (");
-                DEBUG_PRINT(_timers[routineIndex]);
-                DEBUG_PRINTLN("ms)");
-                break;
+                _timers[routineIndex] = (long)arg1 * (long)1000000;
+                _deadlineArmed[routineIndex] = true;
+                ROUTINE_DEBUG_PRINT(F("Routine "));
+                ROUTINE_DEBUG_PRINT(routineIndex);
+                ROUTINE_DEBUG_PRINT(F(" delay: "));
+                ROUTINE_DEBUG_PRINT(arg1);
+                ROUTINE_DEBUG_PRINT(F("s ("));
+                ROUTINE_DEBUG_PRINT(_timers[routineIndex]);
+                ROUTINE_DEBUG_PRINTLN(F("us)"));
+                return false;
+            case INSTRUCTION_WAIT_PIN_HIGH:
+            case INSTRUCTION_WAIT_PIN_LOW:
+                arg1 = read(routineIndex, _indices[routineIndex]);
+                arg2 = read(routineIndex, _indices[routineIndex]);
+                arg3 = read(routineIndex, _indices[routineIndex]);
+                arg4 = read(routineIndex, _indices[routineIndex]);
+                arg5 = read(routineIndex, _indices[routineIndex]);
+                return !_wait(routineIndex, arg1, instruction == INSTRUCTION_WAIT_PIN_HIGH,
+                    arg2 << 8 | arg3, arg4 << 8 | arg5);
+            case INSTRUCTION_PWM_SET:
+                arg1 = read(routineIndex, _indices[routineIndex]);
+                arg2 = read(routineIndex, _indices[routineIndex]);
+                if (PULSE::setPwm(arg1, arg2)) {
+                    TRACE::record(routineIndex, TRACE::EVENT_PWM_SET, arg1);
+                } else {
+                    ROUTINE_DEBUG_PRINT(F("E: Pin "));
+                    ROUTINE_DEBUG_PRINT(arg1);
+                    ROUTINE_DEBUG_PRINTLN(F(" does not support hardware PWM"));
+                }
+                return true;
+            case INSTRUCTION_PULSE_TRAIN:
+                arg1 = read(routineIndex, _indices[routineIndex]);
+                arg2 = read(routineIndex, _indices[routineIndex]);
+                arg3 = read(routineIndex, _indices[routineIndex]);
+                arg4 = read(routineIndex, _indices[routineIndex]);
+                arg5 = read(routineIndex, _indices[routineIndex]);
+                arg6 = read(routineIndex, _indices[routineIndex]);
+                arg7 = read(routineIndex, _indices[routineIndex]);
+                if (PULSE::startTrain(arg1, arg2 << 8 | arg3, arg4 << 8 | arg5, arg6 << 8 | arg7)) {
+                    TRACE::record(routineIndex, TRACE::EVENT_PULSE_TRAIN, arg1);
+                } else {
+                    ROUTINE_DEBUG_PRINT(F("E: No pulse train channel for pin "));
+                    ROUTINE_DEBUG_PRINTLN(arg1);
+                }
+                return true;
+            case INSTRUCTION_PULSE_WAIT:
+                arg1 = read(routineIndex, _indices[routineIndex]);
+                return !_waitPulse(routineIndex, arg1);
             case INSTRUCTION_NOP:
-                break;
+                return true;
         }
+
+        return true;
     }
 
-    void _detectButtonPress(int routineIndex, DATA::Meta *meta) {
-        if (routineIndex >= meta->routineCount) {
+    bool _wait(uint8_t routineIndex, uint8_t pin, bool high, uint16_t timeout, uint16_t target) {
+        volatile uint8_t *pcicr = digitalPinToPCICR(pin);
+        if (pcicr != 0) {
+            uint8_t oldSREG = SREG;
+            cli();
+            *digitalPinToPCMSK(pin) |= _BV(digitalPinToPCMSKbit(pin));
+            *pcicr |= _BV(digitalPinToPCICRbit(pin));
+            SREG = oldSREG;
+            _waitGroups[routineIndex] = _BV(digitalPinToPCICRbit(pin));
+        } else {
+            _waitGroups[routineIndex] = WAIT_POLL;
+        }
+
+        // Interrupt is armed before sampling so a change right after the check still wakes the routine
+        _waitPins[routineIndex] = pin;
+        if (_readPin(pin) == high) {
+            _disarmPin(pin);
+            return false;
+        }
+
+        _waitFlags[routineIndex] = WAIT_ACTIVE | (high ? WAIT_HIGH : 0) | (timeout > 0 ? WAIT_TIMED : 0);
+        _waitTargets[routineIndex] = target;
+        _timers[routineIndex] = (long)timeout * (long)1000;
+
+        ROUTINE_DEBUG_PRINT(F("Routine "));
+        ROUTINE_DEBUG_PRINT(routineIndex);
+        ROUTINE_DEBUG_PRINT(F(" waiting for pin "));
+        ROUTINE_DEBUG_PRINT(pin);
+        ROUTINE_DEBUG_PRINTLN(high ? F(" high") : F(" low"));
+
+        return true;
+    }
+
+    bool _waitPulse(uint8_t routineIndex, uint8_t pin) {
+        // A train that stops right after the check flags the next pass, so the routine still wakes
+        if (!PULSE::trainActive(pin)) {
+            return false;
+        }
+
+        _waitFlags[routineIndex] = WAIT_ACTIVE | WAIT_PULSE;
+        _waitGroups[routineIndex] = WAIT_PULSE_GROUP;
+        _waitPins[routineIndex] = pin;
+        _timers[routineIndex] = 0;
+
+        ROUTINE_DEBUG_PRINT(F("Routine "));
+        ROUTINE_DEBUG_PRINT(routineIndex);
+        ROUTINE_DEBUG_PRINT(F(" waiting for the pulse train on pin "));
+        ROUTINE_DEBUG_PRINTLN(pin);
+
+        return true;
+    }
+
+    bool _resumeWait(uint8_t routineIndex, unsigned long delta) {
+        if (_waitGroups[routineIndex] == WAIT_POLL || (_passPinChanges & _waitGroups[routineIndex])) {
+            bool met;
+            if (_waitFlags[routineIndex] & WAIT_PULSE) {
+                met = !PULSE::trainActive(_waitPins[routineIndex]);
+            } else {
+                met = _readPin(_waitPins[routineIndex]) == ((_waitFlags[routineIndex] & WAIT_HIGH) != 0);
+            }
+            if (met) {
+                _endWait(routineIndex);
+                _timers[routineIndex] = 0;
+                _deadlineArmed[routineIndex] = true;
+                return true;
+            }
+        }
+
+        if (!(_waitFlags[routineIndex] & WAIT_TIMED)) {
+            return false;
+        }
+
+        _timers[routineIndex] -= delta;
+        if (_timers[routineIndex] > 0) {
+            return false;
+        }
+
+        ROUTINE_DEBUG_PRINT(F("Routine "));
+        ROUTINE_DEBUG_PRINT(routineIndex);
+        ROUTINE_DEBUG_PRINTLN(F(" wait timed out"));
+
+        _endWait(routineIndex);
+        _deadlineArmed[routineIndex] = true;
+        _indices[routineIndex] = _waitTargets[routineIndex];
+        return true;
+    }
+
+    void _endWait(uint8_t routineIndex) {
+        bool pinWait = (_waitFlags[routineIndex] & WAIT_ACTIVE) && !(_waitFlags[routineIndex] & WAIT_PULSE);
+        _waitFlags[routineIndex] = 0;
+        if (pinWait && _waitGroups[routineIndex] != WAIT_POLL) {
+            _disarmPin(_waitPins[routineIndex]);
+        }
+    }
+
+    void _disarmPin(uint8_t pin) {
+        // The pin stays armed while another routine still waits on it
+        for (uint8_t routineIndex = 0; routineIndex < CONFIG_MAX_ROUTINES; routineIndex++) {
+            if ((_waitFlags[routineIndex] & WAIT_ACTIVE) && !(_waitFlags[routineIndex] & WAIT_PULSE) &&
+                _waitPins[routineIndex] == pin) {
+                return;
+            }
+        }
+
+        volatile uint8_t *pcicr = digitalPinToPCICR(pin);
+        if (pcicr == 0) {
             return;
         }
 
-        if (_indices[routineIndex] >= 0) {
+        uint8_t oldSREG = SREG;
+        cli();
+        volatile uint8_t *pcmsk = digitalPinToPCMSK(pin);
+        *pcmsk &= ~_BV(digitalPinToPCMSKbit(pin));
+        if (*pcmsk == 0) {
+            *pcicr &= ~_BV(digitalPinToPCICRbit(pin));
+        }
+        SREG = oldSREG;
+    }
+
+    void _takePinChanges() {
+        uint8_t oldSREG = SREG;
+        cli();
+        _passPinChanges = _pinChanges;
+        _pinChanges = 0;
+        SREG = oldSREG;
+
+        if (PULSE::takeTrainStops()) {
+            _passPinChanges |= WAIT_PULSE_GROUP;
+        }
+    }
+
+    bool _readPin(uint8_t pin) {
+        return *portInputRegister(digitalPinToPort(pin)) & digitalPinToBitMask(pin);
+    }
+
+    void _detectButtonPress(int routineIndex, DATA::Meta *meta, unsigned long delta) {
+        // Routines left out of the image are never started, 's' reports them as not loaded
+        if (routineIndex >= meta->routineCount || !_isLoaded(routineIndex)) {
             return;
         }
 
-        if (digitalRead(meta->routineMetaList[routineIndex].buttonPin) == HIGH) {
-            DEBUG_PRINT("Routine ");
-            DEBUG_PRINT(routineIndex);
-            DEBUG_PRINTLN(" button pressed");
+        DATA::RoutineMeta *routineMeta = &meta->routineMetaList[routineIndex];
+        bool pressed = *portInputRegister(_buttonPorts[routineIndex]) & _buttonBitMasks[routineIndex];
+
+        // Contact bounce would count as several presses, a new level only counts once it held long enough
+        bool rising = false;
+        if (pressed == _buttonLevels[routineIndex]) {
+            _buttonDebounceTimers[routineIndex] = 0;
+        } else if (_buttonDebounceTimers[routineIndex] + delta >= CONFIG_BUTTON_DEBOUNCE_US) {
+            _buttonDebounceTimers[routineIndex] = 0;
+            _buttonLevels[routineIndex] = pressed;
+            rising = pressed;
+        } else {
+            _buttonDebounceTimers[routineIndex] += delta;
+        }
+        if (rising) {
+            TRACE::record(routineIndex, TRACE::EVENT_TRIGGER, routineMeta->buttonPin);
+        }
+
+        if (_indices[routineIndex] < 0) {
+            if (_triggerQueueCounts[routineIndex] > 0) {
+                uint16_t latency = (uint16_t)millis() - _triggerQueues[routineIndex][_triggerQueueHeads[routineIndex]];
+                if (latency > _maxTriggerLatencies[routineIndex]) {
+                    _maxTriggerLatencies[routineIndex] = latency;
+                }
+                _triggerQueueHeads[routineIndex] = (_triggerQueueHeads[routineIndex] + 1) % CONFIG_TRIGGER_QUEUE_SIZE;
+                _triggerQueueCounts[routineIndex]--;
+
+                ROUTINE_DEBUG_PRINT(F("Routine "));
+                ROUTINE_DEBUG_PRINT(routineIndex);
+                ROUTINE_DEBUG_PRINTLN(F(" queued trigger started"));
+
+                // A press in this same pass then retriggers the run that just started, under the policy below
+                _startRoutine(routineIndex);
+            } else {
+                // Ignore keeps the original level triggered behaviour on the raw level, the other policies count debounced presses
+                if (routineMeta->retriggerPolicy == RETRIGGER_IGNORE ? pressed : rising) {
+                    ROUTINE_DEBUG_PRINT(F("Routine "));
+                    ROUTINE_DEBUG_PRINT(routineIndex);
+                    ROUTINE_DEBUG_PRINTLN(F(" button pressed"));
+
+                    _startRoutine(routineIndex);
+                }
+                return;
+            }
+        }
+
+        if (!rising) {
+            return;
+        }
+
+        switch (routineMeta->retriggerPolicy) {
+            case RETRIGGER_RESTART:
+                ROUTINE_DEBUG_PRINT(F("Routine "));
+                ROUTINE_DEBUG_PRINT(routineIndex);
+                ROUTINE_DEBUG_PRINTLN(F(" restarted"));
+
+                _startRoutine(routineIndex);
+                break;
+            case RETRIGGER_QUEUE:
+                _queueTrigger(routineIndex, routineMeta);
+                break;
+            case RETRIGGER_COALESCE:
+                if (_triggerQueueCounts[routineIndex] > 0) {
+                    _coalescedTriggers[routineIndex]++;
+                } else {
+                    _queueTrigger(routineIndex, routineMeta);
+                }
+                break;
+            default:
+                _droppedTriggers[routineIndex]++;
+                TRACE::record(routineIndex, TRACE::EVENT_DROPPED, routineMeta->buttonPin);
+                break;
+        }
+    }
+
+    void _startRoutine(uint8_t routineIndex) {
+        TRACE::record(routineIndex, TRACE::EVENT_START, TRACE::NO_PIN);
+        _timers[routineIndex] = 0;
+        _deadlineArmed[routineIndex] = true;
+        _indices[routineIndex] = 0;
+        _endWait(routineIndex);
+    }
+
+    void _queueTrigger(uint8_t routineIndex, DATA::RoutineMeta *routineMeta) {
+        uint8_t depth = routineMeta->retriggerDepth;
+        if (depth == 0 || depth > CONFIG_TRIGGER_QUEUE_SIZE) {
+            depth = CONFIG_TRIGGER_QUEUE_SIZE;
+        }
 
-            _timers[routineIndex] = 0;
-            _indices[routineIndex] = 0;
+        if (_triggerQueueCounts[routineIndex] >= depth) {
+            _droppedTriggers[routineIndex]++;
+            TRACE::record(routineIndex, TRACE::EVENT_DROPPED, routineMeta->buttonPin);
+            return;
         }
+
+        uint8_t tail = (_triggerQueueHeads[routineIndex] + _triggerQueueCounts[routineIndex]) % CONFIG_TRIGGER_QUEUE_SIZE;
+        _triggerQueues[routineIndex][tail] = millis();
+        _triggerQueueCounts[routineIndex]++;
+
+        ROUTINE_DEBUG_PRINT(F("Routine "));
+        ROUTINE_DEBUG_PRINT(routineIndex);
+        ROUTINE_DEBUG_PRINT(F(" trigger queued: "));
+        ROUTINE_DEBUG_PRINTLN(_triggerQueueCounts[routineIndex]);
+    }
+
+    void _startTick() {
+#if CONFIG_ROUTINE_TICK_ISR == true
+        uint8_t oldSREG = SREG;
+        cli();
+        TCCR2A = _BV(WGM21);
+        TCCR2B = ROUTINE_TICK_CLOCK_SELECT;
+        OCR2A = ROUTINE_TICK_CYCLES / ROUTINE_TICK_PRESCALER - 1;
+        TCNT2 = 0;
+        TIFR2 = _BV(OCF2A);
+        TIMSK2 = _BV(OCIE2A);
+        SREG = oldSREG;
+#endif
     }
-}
\ No newline at end of file
+
+    void _stopTick() {
+#if CONFIG_ROUTINE_TICK_ISR == true
+        TIMSK2 = 0;
+#endif
+    }
+}
+
+#if CONFIG_ROUTINE_TICK_ISR == true
+ISR(TIMER2_COMPA_vect) {
+    ROUTINE::tick();
+
+    // A compare match that fired while the tick was running means a whole tick was lost
+    if (TIFR2 & _BV(OCF2A)) {
+        ROUTINE::_tickOverruns++;
+    }
+}
+#endif
+
+#ifdef PCINT0_vect
+ISR(PCINT0_vect) {
+    ROUTINE::_pinChanges |= _BV(0);
+}
+#endif
+
+#ifdef PCINT1_vect
+ISR(PCINT1_vect) {
+    ROUTINE::_pinChanges |= _BV(1);
+}
+#endif
+
+#ifdef PCINT2_vect
+ISR(PCINT2_vect) {
+    ROUTINE::_pinChanges |= _BV(2);
+}
+#endif
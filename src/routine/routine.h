@@ -8,11 +8,42 @@ namespace ROUTINE {
     const uint8_t INSTRUCTION_PIN_LOW = 0x01;
     const uint8_t INSTRUCTION_PIN_HIGH = 0x02;
     const uint8_t INSTRUCTION_DELAY = 0x03;
+    // Wait for a pin level; args: pin, timeout ms (16 bit, 0 waits forever), index to branch to on timeout (16 bit)
+    const uint8_t INSTRUCTION_WAIT_PIN_HIGH = 0x04;
+    const uint8_t INSTRUCTION_WAIT_PIN_LOW = 0x05;
+    // Hardware PWM; args: pin, duty (0-255)
+    const uint8_t INSTRUCTION_PWM_SET = 0x06;
+    // Timer driven pulses; args: pin, count (16 bit, 0 runs until released), high and low time in 100us (16 bit each)
+    const uint8_t INSTRUCTION_PULSE_TRAIN = 0x07;
+    // Wait until the pulse train on a pin has finished; args: pin
+    const uint8_t INSTRUCTION_PULSE_WAIT = 0x08;
     // ...
     const uint8_t INSTRUCTION_NOP = 0xFF;
 
+    // What a trigger does while its routine is already running
+    const uint8_t RETRIGGER_IGNORE = 0x00;
+    const uint8_t RETRIGGER_RESTART = 0x01;
+    const uint8_t RETRIGGER_QUEUE = 0x02;
+    const uint8_t RETRIGGER_COALESCE = 0x03;
+
+    // Bytes taken by an instruction including its arguments, 0 for unknown instructions
+    constexpr uint8_t instructionLength(uint8_t instruction) {
+        return instruction == INSTRUCTION_HALT || instruction == INSTRUCTION_NOP ? 1
+            : instruction == INSTRUCTION_PIN_LOW || instruction == INSTRUCTION_PIN_HIGH ? 2
+            : instruction == INSTRUCTION_DELAY || instruction == INSTRUCTION_PULSE_WAIT ? 2
+            : instruction == INSTRUCTION_PWM_SET ? 3
+            : instruction == INSTRUCTION_WAIT_PIN_HIGH || instruction == INSTRUCTION_WAIT_PIN_LOW ? 6
+            : instruction == INSTRUCTION_PULSE_TRAIN ? 8
+            : 0;
+    }
+
     void setup();
     void loop(unsigned long delta);
+    void tick();
+
+    void start();
+    void stop();
+    void printStats();
 }
 
 #endif
\ No newline at end of file
@@ -1,7 +1,9 @@
 #include "serial_handler/serial_handler.h"
 #include "config.h"
 #include "data/data.h"
+#include "library/library.h"
 #include "routine/routine.h"
+#include "trace/trace.h"
 #include "utils/utils.h"
 #include <Arduino.h>
 
@@ -11,29 +13,41 @@ namespace SERIAL_HANDLER {
     const uint8_t COMMAND_FACTORY_RESET = 'f';
     const uint8_t COMMAND_DUMP = 'd';
     const uint8_t COMMAND_PINS = 'p';
+    const uint8_t COMMAND_STATS = 's';
+    const uint8_t COMMAND_TRACE = 't';
 
     const uint8_t COMMAND_WRITE_HALT = 'h';
     const uint8_t COMMAND_WRITE_PIN_LOW = 'L';
     const uint8_t COMMAND_WRITE_PIN_HIGH = 'H';
     const uint8_t COMMAND_WRITE_DELAY = 'd';
+    const uint8_t COMMAND_WRITE_WAIT_PIN_HIGH = 'U';
+    const uint8_t COMMAND_WRITE_WAIT_PIN_LOW = 'D';
+    const uint8_t COMMAND_WRITE_PWM_SET = 'P';
+    const uint8_t COMMAND_WRITE_PULSE_TRAIN = 'T';
+    const uint8_t COMMAND_WRITE_PULSE_WAIT = 'W';
     const uint8_t COMMAND_WRITE_NOP = 'n';
     const uint8_t COMMAND_WRITE_UNDEFINED = '?';
 
     void _writeRoutines();
     void _readRoutines();
-    int _readInt(int digits);
-    void _writeInt(int value, int digits);
+    long _readInt(int digits);
+    void _writeInt(long value, int digits);
     void _writePins();
     uint8_t _readSkip();
     bool _writeRoutine(uint8_t routineIndex, uint16_t& byteIndex, uint8_t value);
+    bool _writeRoutineWord(uint8_t routineIndex, uint16_t& byteIndex, uint16_t value);
+    void _writeRoutineNops(uint8_t routineIndex, uint16_t& byteIndex, uint8_t count);
+    void _checkWaitTargets(uint8_t routineIndex);
+    bool _isInstructionStart(uint8_t routineIndex, uint16_t byteIndex);
     uint8_t _readRoutine(uint8_t routineIndex, uint16_t& byteIndex);
+    uint16_t _readRoutineWord(uint8_t routineIndex, uint16_t& byteIndex);
 
     void setup() {
         Serial.begin(9600);
-        Serial.println("Serial ready");
-        Serial.println("Version: 1");
+        Serial.println(F("Serial ready"));
+        Serial.println(F("Version: 1"));
         
-        Serial.print("CONFIG_MAX_ROUTINES: ");
+        Serial.print(F("CONFIG_MAX_ROUTINES: "));
         Serial.println(CONFIG_MAX_ROUTINES);
     }
 
@@ -45,12 +59,12 @@ namespace SERIAL_HANDLER {
         uint8_t command = Serial.read();
         byteToHex(command);
         if (command == '\n' || command == '\r') {
-            DEBUG_PRINT("Skipped: ");
+            DEBUG_PRINT(F("Skipped: "));
             DEBUG_PRINTLN(representByte(command));
             return;
         }
 
-        DEBUG_PRINT("Command: ");
+        DEBUG_PRINT(F("Command: "));
         DEBUG_PRINTLN(representByte(command));
 
         switch (command) {
@@ -61,6 +75,7 @@ namespace SERIAL_HANDLER {
                 _readRoutines();
                 break;
             case COMMAND_FACTORY_RESET:
+                ROUTINE::stop();
                 DATA::factoryReset();
                 break;
             case COMMAND_DUMP:
@@ -69,53 +84,100 @@ namespace SERIAL_HANDLER {
             case COMMAND_PINS:
                 _writePins();
                 break;
+            case COMMAND_STATS:
+                ROUTINE::printStats();
+                break;
+            case COMMAND_TRACE:
+                TRACE::dump();
+                break;
             default:
-                DEBUG_PRINTLN("Unknown command");
+                DEBUG_PRINTLN(F("Unknown command"));
                 break;
         }
     }
 
     void _writeRoutines() {
-        DEBUG_PRINTLN("Write begins");
+        DEBUG_PRINTLN(F("Write begins"));
+
+        ROUTINE::stop();
 
         DATA::Meta *meta = DATA::readMeta();
 
-        DEBUG_PRINTLN("Routine count:");
+        DEBUG_PRINTLN(F("Routine count:"));
         meta->routineCount = _readInt(2);
 
         for (int i = 0; i < meta->routineCount; i++) {
-            DEBUG_PRINT("Routine ");
+            DEBUG_PRINT(F("Routine "));
             DEBUG_PRINT(i);
-            DEBUG_PRINTLN(" button pin:");
+            DEBUG_PRINTLN(F(" button pin:"));
             int buttonPin = _readInt(3);
 
-            DEBUG_PRINT("Routine ");
+            DEBUG_PRINT(F("Routine "));
             DEBUG_PRINT(i);
-            DEBUG_PRINTLN(" length:");
+            DEBUG_PRINTLN(F(" length:"));
             int length = _readInt(3);
 
+            DEBUG_PRINT(F("Routine "));
+            DEBUG_PRINT(i);
+            DEBUG_PRINTLN(F(" retrigger policy:"));
+            int retriggerPolicy = _readInt(1);
+
+            DEBUG_PRINT(F("Routine "));
+            DEBUG_PRINT(i);
+            DEBUG_PRINTLN(F(" retrigger queue depth:"));
+            int retriggerDepth = _readInt(1);
+
+            DEBUG_PRINT(F("Routine "));
+            DEBUG_PRINT(i);
+            DEBUG_PRINTLN(F(" priority:"));
+            int priority = _readInt(1);
+
+            DEBUG_PRINT(F("Routine "));
+            DEBUG_PRINT(i);
+            DEBUG_PRINTLN(F(" source:"));
+            int source = _readInt(2);
+            if (source != DATA::SOURCE_EEPROM) {
+                if (source > LIBRARY::count()) {
+                    DEBUG_PRINTLN(F("E: Unknown library routine"));
+                    source = DATA::SOURCE_EEPROM;
+                    length = 0;
+                } else {
+                    length = LIBRARY::length(source - 1);
+                }
+            }
+
             meta->routineMetaList[i].buttonPin = buttonPin;
             meta->routineMetaList[i].length = length;
+            meta->routineMetaList[i].retriggerPolicy = retriggerPolicy;
+            meta->routineMetaList[i].retriggerDepth = retriggerDepth;
+            meta->routineMetaList[i].priority = priority;
+            meta->routineMetaList[i].source = source;
         }
 
         DATA::writeMeta();
 
         for (int i = 0; i < meta->routineCount; i++) {
-            DEBUG_PRINT("Routine ");
+            DEBUG_PRINT(F("Routine "));
             DEBUG_PRINT(i);
-            DEBUG_PRINTLN(" instructions:");
+            DEBUG_PRINTLN(F(" instructions:"));
+
+            if (meta->routineMetaList[i].source != DATA::SOURCE_EEPROM) {
+                DEBUG_PRINTLN(F("Routine is stored in flash"));
+                continue;
+            }
 
             uint16_t index = 0;
             while (index < meta->routineMetaList[i].length) {
-                DEBUG_PRINT("Routine ");
+                DEBUG_PRINT(F("Routine "));
                 DEBUG_PRINT(i);
-                DEBUG_PRINT(" instruction (");
+                DEBUG_PRINT(F(" instruction ("));
                 DEBUG_PRINT(index);
-                DEBUG_PRINT("/");
+                DEBUG_PRINT(F("/"));
                 DEBUG_PRINT(meta->routineMetaList[i].length);
-                DEBUG_PRINTLN("):");
+                DEBUG_PRINTLN(F("):"));
 
                 uint8_t command = _readSkip();
+                long pin, duty, timeout, target, count, highTime, lowTime;
                 switch (command) {
                     case COMMAND_WRITE_HALT:
                         _writeRoutine(i, index, ROUTINE::INSTRUCTION_HALT);
@@ -132,40 +194,124 @@ namespace SERIAL_HANDLER {
                         _writeRoutine(i, index, ROUTINE::INSTRUCTION_DELAY);
                         _writeRoutine(i, index, _readInt(3));
                         break;
+                    case COMMAND_WRITE_WAIT_PIN_HIGH:
+                    case COMMAND_WRITE_WAIT_PIN_LOW:
+                        pin = _readInt(3);
+                        timeout = _readInt(5);
+                        target = _readInt(3);
+                        // Branch targets are checked once the whole routine is written
+                        if (timeout <= 0xFFFF) {
+                            _writeRoutine(i, index, command == COMMAND_WRITE_WAIT_PIN_HIGH ?
+                                ROUTINE::INSTRUCTION_WAIT_PIN_HIGH : ROUTINE::INSTRUCTION_WAIT_PIN_LOW);
+                            _writeRoutine(i, index, pin);
+                            _writeRoutineWord(i, index, timeout);
+                            _writeRoutineWord(i, index, target);
+                        } else {
+                            DEBUG_PRINTLN(F("E: Wait timeout is out of range"));
+                            _writeRoutineNops(i, index, ROUTINE::instructionLength(ROUTINE::INSTRUCTION_WAIT_PIN_HIGH));
+                        }
+                        break;
+                    case COMMAND_WRITE_PWM_SET:
+                        pin = _readInt(3);
+                        duty = _readInt(3);
+                        if (pin >= NUM_DIGITAL_PINS || !validatePwmPin(pin)) {
+                            DEBUG_PRINTLN(F("E: Pin does not support hardware PWM"));
+                            _writeRoutineNops(i, index, ROUTINE::instructionLength(ROUTINE::INSTRUCTION_PWM_SET));
+                        } else if (duty > 0xFF) {
+                            DEBUG_PRINTLN(F("E: PWM duty is out of range"));
+                            _writeRoutineNops(i, index, ROUTINE::instructionLength(ROUTINE::INSTRUCTION_PWM_SET));
+                        } else {
+                            _writeRoutine(i, index, ROUTINE::INSTRUCTION_PWM_SET);
+                            _writeRoutine(i, index, pin);
+                            _writeRoutine(i, index, duty);
+                        }
+                        break;
+                    case COMMAND_WRITE_PULSE_TRAIN:
+                        pin = _readInt(3);
+                        count = _readInt(5);
+                        highTime = _readInt(5);
+                        lowTime = _readInt(5);
+                        if (pin >= NUM_DIGITAL_PINS || !validatePin(pin)) {
+                            DEBUG_PRINTLN(F("E: Pin is not valid"));
+                            _writeRoutineNops(i, index, ROUTINE::instructionLength(ROUTINE::INSTRUCTION_PULSE_TRAIN));
+                        } else if (count <= 0xFFFF && highTime <= 0xFFFF && lowTime <= 0xFFFF) {
+                            _writeRoutine(i, index, ROUTINE::INSTRUCTION_PULSE_TRAIN);
+                            _writeRoutine(i, index, pin);
+                            _writeRoutineWord(i, index, count);
+                            _writeRoutineWord(i, index, highTime);
+                            _writeRoutineWord(i, index, lowTime);
+                        } else {
+                            DEBUG_PRINTLN(F("E: Pulse train argument is out of range"));
+                            _writeRoutineNops(i, index, ROUTINE::instructionLength(ROUTINE::INSTRUCTION_PULSE_TRAIN));
+                        }
+                        break;
+                    case COMMAND_WRITE_PULSE_WAIT:
+                        _writeRoutine(i, index, ROUTINE::INSTRUCTION_PULSE_WAIT);
+                        _writeRoutine(i, index, _readInt(3));
+                        break;
                 }
             }
 
-            DEBUG_PRINTLN("Routine end");
+            _checkWaitTargets(i);
+
+            DEBUG_PRINTLN(F("Routine end"));
         }
 
-        DEBUG_PRINTLN("Write ends");
+        ROUTINE::start();
+
+        DEBUG_PRINTLN(F("Write ends"));
     }
 
     void _readRoutines() {
-        DEBUG_PRINTLN("Read begins");
+        DEBUG_PRINTLN(F("Read begins"));
 
         DATA::Meta *meta = DATA::readMeta();
 
-        DEBUG_PRINTLN("Routine count:");
+        DEBUG_PRINTLN(F("Routine count:"));
         _writeInt(meta->routineCount, 2);
 
         for (int i = 0; i < meta->routineCount; i++) {
-            DEBUG_PRINT("Routine ");
+            DEBUG_PRINT(F("Routine "));
             DEBUG_PRINT(i);
-            DEBUG_PRINTLN(" button pin:");
+            DEBUG_PRINTLN(F(" button pin:"));
             _writeInt(meta->routineMetaList[i].buttonPin, 3);
 
-            DEBUG_PRINT("Routine ");
+            DEBUG_PRINT(F("Routine "));
+            DEBUG_PRINT(i);
+            DEBUG_PRINTLN(F(" length:"));
+            bool flash = meta->routineMetaList[i].source != DATA::SOURCE_EEPROM;
+            _writeInt(flash ? 0 : meta->routineMetaList[i].length, 3);
+
+            DEBUG_PRINT(F("Routine "));
             DEBUG_PRINT(i);
-            DEBUG_PRINTLN(" length:");
-            _writeInt(meta->routineMetaList[i].length, 3);
+            DEBUG_PRINTLN(F(" retrigger policy:"));
+            _writeInt(meta->routineMetaList[i].retriggerPolicy, 1);
+
+            DEBUG_PRINT(F("Routine "));
+            DEBUG_PRINT(i);
+            DEBUG_PRINTLN(F(" retrigger queue depth:"));
+            _writeInt(meta->routineMetaList[i].retriggerDepth, 1);
+
+            DEBUG_PRINT(F("Routine "));
+            DEBUG_PRINT(i);
+            DEBUG_PRINTLN(F(" priority:"));
+            _writeInt(meta->routineMetaList[i].priority, 1);
+
+            DEBUG_PRINT(F("Routine "));
+            DEBUG_PRINT(i);
+            DEBUG_PRINTLN(F(" source:"));
+            _writeInt(meta->routineMetaList[i].source, 2);
         }
 
-        DEBUG_PRINTLN("Instructions:");
+        DEBUG_PRINTLN(F("Instructions:"));
         for (int i = 0; i < meta->routineCount; i++) {
-            DEBUG_PRINT("Routine ");
+            DEBUG_PRINT(F("Routine "));
             DEBUG_PRINT(i);
-            DEBUG_PRINTLN(" instructions:");
+            DEBUG_PRINTLN(F(" instructions:"));
+
+            if (meta->routineMetaList[i].source != DATA::SOURCE_EEPROM) {
+                continue;
+            }
 
             uint16_t index = 0;
             while (index < meta->routineMetaList[i].length) {
@@ -190,6 +336,34 @@ namespace SERIAL_HANDLER {
                         arg1 = _readRoutine(i, index);
                         _writeInt(arg1, 3);
                         break;
+                    case ROUTINE::INSTRUCTION_WAIT_PIN_HIGH:
+                    case ROUTINE::INSTRUCTION_WAIT_PIN_LOW:
+                        Serial.print(instruction == ROUTINE::INSTRUCTION_WAIT_PIN_HIGH ?
+                            COMMAND_WRITE_WAIT_PIN_HIGH : COMMAND_WRITE_WAIT_PIN_LOW);
+                        arg1 = _readRoutine(i, index);
+                        _writeInt(arg1, 3);
+                        _writeInt(_readRoutineWord(i, index), 5);
+                        _writeInt(_readRoutineWord(i, index), 3);
+                        break;
+                    case ROUTINE::INSTRUCTION_PWM_SET:
+                        Serial.print(COMMAND_WRITE_PWM_SET);
+                        arg1 = _readRoutine(i, index);
+                        _writeInt(arg1, 3);
+                        _writeInt(_readRoutine(i, index), 3);
+                        break;
+                    case ROUTINE::INSTRUCTION_PULSE_TRAIN:
+                        Serial.print(COMMAND_WRITE_PULSE_TRAIN);
+                        arg1 = _readRoutine(i, index);
+                        _writeInt(arg1, 3);
+                        _writeInt(_readRoutineWord(i, index), 5);
+                        _writeInt(_readRoutineWord(i, index), 5);
+                        _writeInt(_readRoutineWord(i, index), 5);
+                        break;
+                    case ROUTINE::INSTRUCTION_PULSE_WAIT:
+                        Serial.print(COMMAND_WRITE_PULSE_WAIT);
+                        arg1 = _readRoutine(i, index);
+                        _writeInt(arg1, 3);
+                        break;
                     case ROUTINE::INSTRUCTION_NOP:
                         Serial.print(COMMAND_WRITE_NOP);
                         break;
@@ -202,11 +376,11 @@ namespace SERIAL_HANDLER {
 
         Serial.println();
 
-        DEBUG_PRINTLN("Read ends");
+        DEBUG_PRINTLN(F("Read ends"));
     }
 
     void _writePins() {
-        DEBUG_PRINTLN("Write pins");
+        DEBUG_PRINTLN(F("Write pins"));
 
         DATA::Meta *meta = DATA::readMeta();
 
@@ -215,19 +389,19 @@ namespace SERIAL_HANDLER {
             meta->defaultPinStates[i] = pinByte;
 
             DEBUG_PRINT(i + 1);
-            DEBUG_PRINTLN("/32");
+            DEBUG_PRINTLN(F("/32"));
         }
 
         DATA::writeMeta();
     }
 
-    int _readInt(int digits) {
-        DEBUG_PRINT("Read int (");
+    long _readInt(int digits) {
+        DEBUG_PRINT(F("Read int ("));
         DEBUG_PRINT(digits);
-        DEBUG_PRINTLN(" digits): ");
+        DEBUG_PRINTLN(F(" digits): "));
 
         int readDigits = 0;
-        int value = 0;
+        long value = 0;
         while (readDigits < digits) {
             while (Serial.available() <= 0) {
                 continue;
@@ -247,10 +421,10 @@ namespace SERIAL_HANDLER {
         return value;
     }
 
-    void _writeInt(int value, int digits) {
+    void _writeInt(long value, int digits) {
         // Calculate the number of digits in the integer
         int numberOfDigits = 0;
-        int temp = value;
+        long temp = value;
         do {
             temp /= 10;
             numberOfDigits++;
@@ -289,13 +463,69 @@ namespace SERIAL_HANDLER {
         if (result) {
             byteIndex++;
         } else {
-            DEBUG_PRINTLN("E: Write failed");
+            DEBUG_PRINTLN(F("E: Write failed"));
         }
 
         return result;
     }
 
+    bool _writeRoutineWord(uint8_t routineIndex, uint16_t& byteIndex, uint16_t value) {
+        return _writeRoutine(routineIndex, byteIndex, value >> 8) &&
+            _writeRoutine(routineIndex, byteIndex, value & 0xFF);
+    }
+
+    void _writeRoutineNops(uint8_t routineIndex, uint16_t& byteIndex, uint8_t count) {
+        for (uint8_t i = 0; i < count; i++) {
+            _writeRoutine(routineIndex, byteIndex, ROUTINE::INSTRUCTION_NOP);
+        }
+    }
+
+    void _checkWaitTargets(uint8_t routineIndex) {
+        uint16_t length = DATA::readMeta()->routineMetaList[routineIndex].length;
+        uint16_t index = 0;
+        while (index < length) {
+            uint8_t instruction = DATA::readRoutineByte(routineIndex, index);
+            // The interpreter steps over unknown instructions one byte at a time
+            uint8_t instructionLength = ROUTINE::instructionLength(instruction);
+            if (instructionLength == 0) {
+                instructionLength = 1;
+            }
+
+            if (instruction == ROUTINE::INSTRUCTION_WAIT_PIN_HIGH || instruction == ROUTINE::INSTRUCTION_WAIT_PIN_LOW) {
+                uint16_t targetIndex = index + 4;
+                if (!_isInstructionStart(routineIndex, _readRoutineWord(routineIndex, targetIndex))) {
+                    DEBUG_PRINTLN(F("E: Wait branch target is not the start of an instruction"));
+                    uint16_t nopIndex = index;
+                    _writeRoutineNops(routineIndex, nopIndex, instructionLength);
+                }
+            }
+
+            index += instructionLength;
+        }
+    }
+
+    bool _isInstructionStart(uint8_t routineIndex, uint16_t byteIndex) {
+        uint16_t length = DATA::readMeta()->routineMetaList[routineIndex].length;
+        if (byteIndex > length) {
+            return false;
+        }
+
+        uint16_t index = 0;
+        while (index < byteIndex) {
+            uint8_t instructionLength = ROUTINE::instructionLength(DATA::readRoutineByte(routineIndex, index));
+            index += instructionLength > 0 ? instructionLength : 1;
+        }
+
+        // Branching to the end finishes the routine
+        return index == byteIndex;
+    }
+
     uint8_t _readRoutine(uint8_t routineIndex, uint16_t& byteIndex) {
-        return DATA::readRoutineByte(routineIndex, byteIndex);
+        return DATA::readRoutineByte(routineIndex, byteIndex++);
+    }
+
+    uint16_t _readRoutineWord(uint8_t routineIndex, uint16_t& byteIndex) {
+        uint16_t high = _readRoutine(routineIndex, byteIndex);
+        return high << 8 | _readRoutine(routineIndex, byteIndex);
     }
 }
@@ -0,0 +1,42 @@
+#include "trace/trace.h"
+#include "config.h"
+#include <Arduino.h>
+
+namespace TRACE {
+#if CONFIG_TRACE == true
+    Event _events[CONFIG_TRACE_SIZE];
+    uint8_t _head = 0;
+    uint32_t _recorded = 0;
+    volatile bool _frozen = false;
+#endif
+
+    void dump() {
+#if CONFIG_TRACE == true
+        _frozen = true;
+
+        // Oldest event first, the buffer only holds the last CONFIG_TRACE_SIZE events
+        uint8_t count = _recorded < CONFIG_TRACE_SIZE ? _recorded : CONFIG_TRACE_SIZE;
+        uint8_t index = (_head - count) & (CONFIG_TRACE_SIZE - 1);
+
+        Serial.print(F("Trace "));
+        Serial.print(count);
+        Serial.print(F("/"));
+        Serial.println(_recorded);
+
+        char buffer[13];
+        for (uint8_t i = 0; i < count; i++) {
+            Event *e = &_events[index];
+            sprintf(buffer, "%08lX%02X%02X", (unsigned long)e->time, e->routineEvent, e->pin);
+            Serial.println(buffer);
+            index = (index + 1) & (CONFIG_TRACE_SIZE - 1);
+        }
+
+        _head = 0;
+        _recorded = 0;
+        _frozen = false;
+#else
+        Serial.println(F("Trace 0/0"));
+#endif
+        Serial.println(F("Done"));
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef TRACE_h
+#define TRACE_h
+
+#include "config.h"
+#include <Arduino.h>
+
+namespace TRACE {
+    const uint8_t EVENT_TRIGGER = 0x00;
+    const uint8_t EVENT_START = 0x01;
+    const uint8_t EVENT_FINISH = 0x02;
+    const uint8_t EVENT_PIN_LOW = 0x03;
+    const uint8_t EVENT_PIN_HIGH = 0x04;
+    const uint8_t EVENT_PWM_SET = 0x05;
+    const uint8_t EVENT_PULSE_TRAIN = 0x06;
+    const uint8_t EVENT_DROPPED = 0x07;
+
+    const uint8_t NO_PIN = 0xFF;
+
+    struct Event {
+        uint32_t time; // micros()
+        uint8_t routineEvent; // Routine index in the high nibble, event in the low nibble
+        uint8_t pin;
+    };
+
+#if CONFIG_TRACE == true
+    static_assert((CONFIG_TRACE_SIZE & (CONFIG_TRACE_SIZE - 1)) == 0, "CONFIG_TRACE_SIZE must be a power of two");
+
+    extern Event _events[CONFIG_TRACE_SIZE];
+    extern uint8_t _head;
+    extern uint32_t _recorded;
+    extern volatile bool _frozen;
+
+    inline void record(uint8_t routineIndex, uint8_t event, uint8_t pin) {
+        if (_frozen) {
+            return;
+        }
+
+        Event *e = &_events[_head];
+        e->time = micros();
+        e->routineEvent = routineIndex << 4 | event;
+        e->pin = pin;
+        _head = (_head + 1) & (CONFIG_TRACE_SIZE - 1);
+        _recorded++;
+    }
+#else
+    inline void record(uint8_t routineIndex, uint8_t event, uint8_t pin) {}
+#endif
+
+    void dump();
+}
+
+#endif
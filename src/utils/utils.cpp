@@ -71,9 +71,9 @@ char* representByte(uint8_t byte) {
 
 bool validatePin(uint8_t pin) {
 #if ARDUINO_AVR_UNO
-    if (pin <= 0 && pin >= 13) {
+    if (pin <= 13) {
         return true;
-    } else if (pin <= A0 && pin >= A5) {
+    } else if (pin >= A0 && pin <= A5) {
         return true;
     }
     return false;
@@ -86,4 +86,33 @@ bool validatePin(uint8_t pin) {
         delay(500);
     }
 #endif
-}
\ No newline at end of file
+}
+
+bool validatePwmPin(uint8_t pin) {
+    if (!digitalPinHasPWM(pin)) {
+        return false;
+    }
+
+    switch (digitalPinToTimer(pin)) {
+        // Timer1 drives pulse trains
+#ifdef TIMER1A
+        case TIMER1A:
+#endif
+#ifdef TIMER1B
+        case TIMER1B:
+#endif
+            return false;
+#if CONFIG_ROUTINE_TICK_ISR == true
+        // Timer2 drives the routine tick
+#ifdef TIMER2A
+        case TIMER2A:
+#endif
+#ifdef TIMER2B
+        case TIMER2B:
+#endif
+            return false;
+#endif
+        default:
+            return true;
+    }
+}
@@ -26,5 +26,6 @@ char* representByte(uint8_t byte, char* buffer);
 char* representByte(uint8_t byte);
 
 bool validatePin(uint8_t pin);
+bool validatePwmPin(uint8_t pin);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,440 @@
+#!/usr/bin/env python3
+"""Static timing analysis of routine images.
+
+Reads EEPROM images in the layout written by DATA::writeMeta / DATA::writeRoutineByte, either as
+the text printed by the 'd' serial command or as a raw binary dump, and symbolically executes every
+routine with the ROUTINE interpreter semantics. For each image it reports per-routine worst-case
+duration, interpreter byte fetches, longest run between yields, pins driven by more than one routine
+and a worst-case load profile with every routine triggered at the same moment: edges and instructions
+per tick against the pass budget, and pulse trains running at once against the two Timer1 channels.
+
+    python3 tools/analyze_routines.py image.txt
+    python3 tools/analyze_routines.py images/*.bin --json -j 8
+"""
+
+import argparse
+import json
+import multiprocessing
+import os
+import sys
+
+# Layout constants, mirror src/data/data.cpp
+META_DATA_VERSION_OFFSET = 0
+DEFAULT_PIN_STATES_OFFSET = 16
+DEFAULT_PIN_STATES_SIZE = 32
+ROUTINE_COUNT_OFFSET = DEFAULT_PIN_STATES_OFFSET + DEFAULT_PIN_STATES_SIZE
+ROUTINE_META_LIST_OFFSET = ROUTINE_COUNT_OFFSET + 1
+ROUTINE_META_SIZES = {0x01: 3, 0x02: 4, 0x03: 5, 0x04: 6}
+MAX_ROUTINES = 16
+DEFAULT_EEPROM_VALUE = 0xFF
+SOURCE_EEPROM = 0x00
+
+# Instructions, mirror src/routine/routine.h
+HALT = 0x00
+PIN_LOW = 0x01
+PIN_HIGH = 0x02
+DELAY = 0x03
+WAIT_PIN_HIGH = 0x04
+WAIT_PIN_LOW = 0x05
+PWM_SET = 0x06
+PULSE_TRAIN = 0x07
+PULSE_WAIT = 0x08
+NOP = 0xFF
+
+INSTRUCTION_LENGTHS = {
+    HALT: 1, NOP: 1,
+    PIN_LOW: 2, PIN_HIGH: 2, DELAY: 2, PULSE_WAIT: 2,
+    PWM_SET: 3,
+    WAIT_PIN_HIGH: 6, WAIT_PIN_LOW: 6,
+    PULSE_TRAIN: 8,
+}
+
+RETRIGGER_QUEUE = 0x02
+RETRIGGER_COALESCE = 0x03
+PULSE_TIME_UNIT_US = 100
+
+# Interpreter configuration, mirror include/config.h and src/pulse/pulse.cpp
+TICK_US = 1000
+INSTRUCTION_BUDGET = 8
+PASS_BUDGET = 64
+TRIGGER_QUEUE_SIZE = 4
+PULSE_CHANNELS = 2
+
+# Bounds on the symbolic execution of a single routine
+MAX_PATHS = 4096
+MAX_STEPS = 100000
+
+
+class ImageError(Exception):
+    pass
+
+
+def load_image(path):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    try:
+        text = data.decode("ascii")
+    except UnicodeDecodeError:
+        return data
+
+    tokens = [token for token in text.split() if token != "Done"]
+    if tokens and all(len(token) == 2 for token in tokens):
+        try:
+            return bytes(int(token, 16) for token in tokens)
+        except ValueError:
+            pass
+    return data
+
+
+def parse_image(image):
+    if len(image) <= ROUTINE_META_LIST_OFFSET:
+        raise ImageError("image is shorter than the meta block")
+
+    version = image[META_DATA_VERSION_OFFSET]
+    if version == DEFAULT_EEPROM_VALUE:
+        raise ImageError("EEPROM is uninitialized")
+    if version not in ROUTINE_META_SIZES:
+        raise ImageError(f"unsupported data version {version}")
+    meta_size = ROUTINE_META_SIZES[version]
+
+    count = image[ROUTINE_COUNT_OFFSET]
+    if count == DEFAULT_EEPROM_VALUE or count > MAX_ROUTINES:
+        count = 0
+
+    routines = []
+    offset = ROUTINE_META_LIST_OFFSET + count * meta_size
+    for i in range(count):
+        entry = image[ROUTINE_META_LIST_OFFSET + i * meta_size:ROUTINE_META_LIST_OFFSET + (i + 1) * meta_size]
+        routine = {
+            "index": i,
+            "button_pin": entry[0],
+            "length": entry[1] << 8 | entry[2],
+            "retrigger_policy": entry[3] >> 4 if version >= 0x02 else 0,
+            "retrigger_depth": entry[3] & 0x0F if version >= 0x02 else 0,
+            "priority": entry[4] if version >= 0x03 else 0,
+            "source": entry[5] if version >= 0x04 else SOURCE_EEPROM,
+        }
+        if routine["source"] == SOURCE_EEPROM:
+            routine["bytes"] = image[offset:offset + routine["length"]]
+            if len(routine["bytes"]) < routine["length"]:
+                raise ImageError(f"routine {i} runs past the end of the image")
+            offset += routine["length"]
+        else:
+            routine["bytes"] = None
+        routines.append(routine)
+
+    return {"version": version, "routines": routines, "eeprom_used": offset}
+
+
+def _word(code, index):
+    high = code[index] if index < len(code) else 0
+    low = code[index + 1] if index + 1 < len(code) else 0
+    return high << 8 | low
+
+
+def _release(trains, finished, pin, time):
+    """Stop the pulse train on a pin at the given time, if one is running."""
+    train = trains.pop(pin, None)
+    if train is not None:
+        start, _, length = train
+        finished.append((pin, start, time if length is None else min(time, start + length)))
+
+
+def execute(code):
+    """Explore every path through a routine.
+
+    Waits fork into "condition met" and "timed out". A met wait costs nothing at best and, at worst, all but
+    the last moment of its timeout. Returns the per-path results: worst and best duration in microseconds
+    (None when unbounded), bytes fetched, edges as (time, pin, kind), start time of every instruction, pulse
+    trains as (pin, start, end) with end None when the train outlives the routine, longest run of instructions
+    between two yields. Times on the path are worst-case times.
+    """
+    results = []
+    # index, worst time, best time, fetches, edges, instruction times, running trains
+    # (pin -> (start, best start, length)), finished trains, run length, visited wait indices
+    pending = [(0, 0, 0, 0, (), (), {}, (), 0, frozenset())]
+    steps = 0
+
+    while pending:
+        if len(results) + len(pending) > MAX_PATHS:
+            raise ImageError("too many paths to analyze")
+        index, time, best, fetches, edges, instructions, trains, finished, run, visited = pending.pop()
+        edges = list(edges)
+        instructions = list(instructions)
+        trains = dict(trains)
+        finished = list(finished)
+        longest_run = run
+        # Worst case never ends; stalled: the best case never ends either
+        unbounded = False
+        stalled = False
+
+        while index < len(code):
+            steps += 1
+            if steps > MAX_STEPS:
+                raise ImageError("routine did not terminate within the step limit")
+
+            instruction = code[index]
+            length = INSTRUCTION_LENGTHS.get(instruction, 1)
+            fetches += length
+            instructions.append(time)
+            run += 1
+            longest_run = max(longest_run, run)
+            arg = code[index + 1] if index + 1 < len(code) else 0
+            next_index = index + length
+
+            if instruction == HALT:
+                break
+            elif instruction in (PIN_LOW, PIN_HIGH):
+                _release(trains, finished, arg, time)
+                edges.append((time, arg, "high" if instruction == PIN_HIGH else "low"))
+            elif instruction == DELAY:
+                time += arg * 1000000
+                best += arg * 1000000
+                run = 0
+            elif instruction == PWM_SET:
+                _release(trains, finished, arg, time)
+                edges.append((time, arg, "pwm"))
+            elif instruction == PULSE_TRAIN:
+                _release(trains, finished, arg, time)
+                count = _word(code, index + 2)
+                high = max(_word(code, index + 4), 1) * PULSE_TIME_UNIT_US
+                low = max(_word(code, index + 6), 1) * PULSE_TIME_UNIT_US
+                # The channel stops on the last falling edge, so the final low time is not part of the train
+                trains[arg] = (time, best, None if count == 0 else count * high + (count - 1) * low)
+                edges.append((time, arg, "pulse"))
+            elif instruction == PULSE_WAIT:
+                if arg in trains:
+                    start, best_start, train_length = trains[arg]
+                    if train_length is None:
+                        unbounded = stalled = True
+                        break
+                    _release(trains, finished, arg, start + train_length)
+                    time = max(time, start + train_length)
+                    best = max(best, best_start + train_length)
+                    run = 0
+            elif instruction in (WAIT_PIN_HIGH, WAIT_PIN_LOW):
+                timeout = _word(code, index + 2) * 1000
+                target = _word(code, index + 4)
+                if timeout == 0:
+                    # Without a timeout the worst case never wakes up
+                    unbounded = True
+                elif index in visited:
+                    # Timing out into a loop that reaches this wait again can repeat forever
+                    results.append({"duration": None, "best": None, "fetches": fetches, "edges": list(edges),
+                                    "instructions": list(instructions), "trains": list(finished),
+                                    "longest_run": longest_run})
+                else:
+                    pending.append((target, time + timeout, best + timeout, fetches, tuple(edges),
+                                    tuple(instructions), dict(trains), tuple(finished), 0, visited | {index}))
+                # Met, the routine carries on: at once at best, just before the timeout at worst
+                time += timeout
+            index = next_index
+
+        for pin, (start, _, train_length) in trains.items():
+            finished.append((pin, start, None if train_length is None else start + train_length))
+
+        results.append({
+            "duration": None if unbounded else time,
+            "best": None if stalled else best,
+            "fetches": fetches,
+            "edges": edges,
+            "instructions": instructions,
+            "trains": finished,
+            "longest_run": longest_run,
+        })
+
+    return results
+
+
+def _peak_overlap(intervals):
+    """Most (start, end) intervals open at the same moment, end None is open forever."""
+    events = []
+    for start, end in intervals:
+        events.append((start, 1))
+        if end is not None:
+            events.append((end, -1))
+    # A train that ends frees its channel for one starting at the same moment
+    events.sort(key=lambda event: (event[0], event[1]))
+    peak = current = 0
+    for _, change in events:
+        current += change
+        peak = max(peak, current)
+    return peak
+
+
+def _peak_per_tick(times):
+    """Most of the given times that fall into the same interpreter tick."""
+    per_tick = {}
+    for time in times:
+        per_tick[time // TICK_US] = per_tick.get(time // TICK_US, 0) + 1
+    return max(per_tick.values(), default=0)
+
+
+def analyze_routine(routine):
+    report = {
+        "index": routine["index"],
+        "button_pin": routine["button_pin"],
+        "priority": routine["priority"],
+        "retrigger_policy": routine["retrigger_policy"],
+        "source": routine["source"],
+    }
+    if routine["bytes"] is None:
+        report["note"] = f"flash library routine {routine['source'] - 1}, not part of the image"
+        report["pins"] = []
+        return report, None
+
+    paths = execute(routine["bytes"])
+    bounded = [path for path in paths if path["duration"] is not None]
+    worst = max(bounded, key=lambda path: path["duration"]) if len(bounded) == len(paths) else None
+
+    report["length"] = routine["length"]
+    report["paths"] = len(paths)
+    report["worst_duration_us"] = worst["duration"] if worst else None
+    bests = [path["best"] for path in paths if path["best"] is not None]
+    report["best_duration_us"] = min(bests) if bests else None
+    report["worst_fetches"] = max(path["fetches"] for path in paths)
+    report["longest_run"] = max(path["longest_run"] for path in paths)
+    report["exceeds_budget"] = report["longest_run"] > INSTRUCTION_BUDGET
+    report["pins"] = sorted({pin for path in paths for _, pin, _ in path["edges"]})
+    report["peak_trains"] = max(_peak_overlap([(start, end) for _, start, end in path["trains"]]) for path in paths)
+    report["exceeds_channels"] = report["peak_trains"] > PULSE_CHANNELS
+
+    # Queued triggers run back to back, so the routine can stay busy for several runs
+    runs = 1
+    if routine["retrigger_policy"] == RETRIGGER_QUEUE:
+        depth = routine["retrigger_depth"]
+        runs += TRIGGER_QUEUE_SIZE if depth == 0 or depth > TRIGGER_QUEUE_SIZE else depth
+    elif routine["retrigger_policy"] == RETRIGGER_COALESCE:
+        runs += 1
+    report["worst_busy_us"] = worst["duration"] * runs if worst else None
+
+    profile_path = worst if worst else max(paths, key=lambda path: len(path["edges"]))
+    return report, profile_path
+
+
+def analyze_image(path):
+    try:
+        image = parse_image(load_image(path))
+        reports = []
+        profiles = {}
+        for routine in image["routines"]:
+            report, profile_path = analyze_routine(routine)
+            reports.append(report)
+            if profile_path is not None:
+                profiles[routine["index"]] = profile_path
+    except (OSError, ImageError) as e:
+        return {"image": path, "error": str(e)}
+
+    drivers = {}
+    for report in reports:
+        for pin in report["pins"]:
+            drivers.setdefault(pin, []).append(report["index"])
+    buttons = {report["button_pin"]: report["index"] for report in reports}
+
+    conflicts = [{"pin": pin, "routines": routines} for pin, routines in sorted(drivers.items()) if len(routines) > 1]
+    button_conflicts = [{"pin": pin, "button_of": buttons[pin], "driven_by": drivers[pin]}
+                        for pin in sorted(drivers) if pin in buttons]
+
+    # Worst case: every routine triggered in the same pass
+    edge_times = [time for path in profiles.values() for time, _, _ in path["edges"]]
+    instruction_times = [time for path in profiles.values() for time in path["instructions"]]
+    train_intervals = [(start, end) for path in profiles.values() for _, start, end in path["trains"]]
+    peak_instructions = _peak_per_tick(instruction_times)
+
+    intervals = [(0, report["worst_busy_us"]) for report in reports if "worst_busy_us" in report]
+    change_points = sorted({0} | {end for _, end in intervals if end is not None})
+    active_profile = []
+    for time in change_points:
+        active = sum(1 for _, end in intervals if end is None or end > time)
+        active_profile.append({"from_us": time, "active": active})
+
+    return {
+        "image": path,
+        "version": image["version"],
+        "eeprom_used": image["eeprom_used"],
+        "routines": reports,
+        "total_worst_fetches": sum(report.get("worst_fetches", 0) for report in reports),
+        "shared_pins": conflicts,
+        "button_pins_driven": button_conflicts,
+        "peak_concurrent": max((point["active"] for point in active_profile), default=0),
+        "peak_edges_per_tick": _peak_per_tick(edge_times),
+        "peak_instructions_per_tick": peak_instructions,
+        # Passes the busiest tick's work is spread over once the pass budget defers the rest
+        "passes_for_peak": -(-peak_instructions // PASS_BUDGET),
+        "peak_concurrent_trains": _peak_overlap(train_intervals),
+        "active_profile": active_profile,
+    }
+
+
+def _format_us(value):
+    if value is None:
+        return "unbounded"
+    return f"{value / 1000:.1f}ms"
+
+
+def print_report(result, out):
+    out.write(f"== {result['image']}\n")
+    if "error" in result:
+        out.write(f"error: {result['error']}\n\n")
+        return
+
+    out.write(f"data version {result['version']}, {result['eeprom_used']} EEPROM bytes used\n")
+    for report in result["routines"]:
+        line = f"routine {report['index']:2d} (button {report['button_pin']}, priority {report['priority']}): "
+        if "note" in report:
+            out.write(line + report["note"] + "\n")
+            continue
+        line += (f"worst {_format_us(report['worst_duration_us'])}, best {_format_us(report['best_duration_us'])}, "
+                 f"busy {_format_us(report['worst_busy_us'])}, {report['worst_fetches']} fetches, "
+                 f"{report['paths']} paths, pins {report['pins']}")
+        if report["exceeds_budget"]:
+            line += f", {report['longest_run']} instructions between yields exceeds the budget of {INSTRUCTION_BUDGET}"
+        if report["exceeds_channels"]:
+            line += f", {report['peak_trains']} pulse trains at once exceed the {PULSE_CHANNELS} channels"
+        out.write(line + "\n")
+
+    out.write(f"total worst-case fetches: {result['total_worst_fetches']}\n")
+    for conflict in result["shared_pins"]:
+        out.write(f"shared pin {conflict['pin']}: routines {conflict['routines']}\n")
+    for conflict in result["button_pins_driven"]:
+        out.write(f"pin {conflict['pin']} is the button of routine {conflict['button_of']} "
+                  f"and driven by routines {conflict['driven_by']}\n")
+    out.write(f"peak concurrent routines: {result['peak_concurrent']}, peak edges per tick: {result['peak_edges_per_tick']}\n")
+    line = f"peak instructions per tick: {result['peak_instructions_per_tick']} (pass budget {PASS_BUDGET})"
+    if result["passes_for_peak"] > 1:
+        line += f", deferred over {result['passes_for_peak']} passes"
+    out.write(line + "\n")
+    line = f"peak concurrent pulse trains: {result['peak_concurrent_trains']}"
+    if result["peak_concurrent_trains"] > PULSE_CHANNELS:
+        line += f", more than the {PULSE_CHANNELS} channels, PULSE_TRAIN fails on the extra pins"
+    out.write(line + "\n")
+    out.write("active routines over time: " + ", ".join(
+        f"{_format_us(point['from_us'])}: {point['active']}" for point in result["active_profile"]) + "\n\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("images", nargs="+", help="EEPROM images, 'd' command output or raw binary")
+    parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count(), help="parallel workers")
+    parser.add_argument("--json", action="store_true", help="print the results as JSON")
+    args = parser.parse_args()
+
+    if args.jobs > 1 and len(args.images) > 1:
+        with multiprocessing.Pool(min(args.jobs, len(args.images))) as pool:
+            results = pool.map(analyze_image, args.images, chunksize=max(1, len(args.images) // (args.jobs * 4)))
+    else:
+        results = [analyze_image(path) for path in args.images]
+
+    if args.json:
+        json.dump(results, sys.stdout, indent=2)
+        sys.stdout.write("\n")
+    else:
+        for result in results:
+            print_report(result, sys.stdout)
+
+    return 1 if any("error" in result for result in results) else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
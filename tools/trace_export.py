@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+"""Render a trace captured with the 't' serial command as a VCD waveform or a CSV timeline.
+
+Feed it the serial output (a log file or stdin). Every "Trace N/M" ... "Done" block is parsed;
+each record is 12 hex characters: 8 for the micros() timestamp, 2 for the routine index (high
+nibble) and event (low nibble), 2 for the pin.
+
+    python3 tools/trace_export.py capture.log --format vcd -o capture.vcd
+    python3 tools/trace_export.py capture.log --format csv
+"""
+
+import argparse
+import re
+import sys
+
+EVENTS = {
+    0x00: "trigger",
+    0x01: "start",
+    0x02: "finish",
+    0x03: "pin_low",
+    0x04: "pin_high",
+    0x05: "pwm_set",
+    0x06: "pulse_train",
+    0x07: "dropped",
+}
+
+NO_PIN = 0xFF
+HEADER = re.compile(r"^Trace (\d+)/(\d+)$")
+RECORD = re.compile(r"^([0-9A-Fa-f]{8})([0-9A-Fa-f]{2})([0-9A-Fa-f]{2})$")
+
+
+def parse(lines):
+    """Return the records of every trace block, with timestamps unwrapped across micros() overflow."""
+    records = []
+    in_block = False
+    offset = 0
+    last = None
+    for line in lines:
+        line = line.strip()
+        header = HEADER.match(line)
+        if header:
+            in_block = True
+            recorded, held = int(header.group(2)), int(header.group(1))
+            if recorded > held:
+                print(f"warning: {recorded - held} older events were overwritten", file=sys.stderr)
+            continue
+        if line == "Done":
+            in_block = False
+            continue
+        if not in_block:
+            continue
+
+        record = RECORD.match(line)
+        if not record:
+            continue
+
+        time = int(record.group(1), 16)
+        if last is not None and time + offset < last:
+            offset += 1 << 32
+        time += offset
+        last = time
+
+        routine_event = int(record.group(2), 16)
+        records.append({
+            "time": time,
+            "routine": routine_event >> 4,
+            "event": EVENTS.get(routine_event & 0x0F, f"unknown_{routine_event & 0x0F}"),
+            "pin": int(record.group(3), 16),
+        })
+    return records
+
+
+def write_csv(records, out):
+    out.write("time_us,routine,event,pin\n")
+    for r in records:
+        pin = "" if r["pin"] == NO_PIN else r["pin"]
+        out.write(f'{r["time"]},{r["routine"]},{r["event"]},{pin}\n')
+
+
+def _identifier(index):
+    # VCD identifiers are built from the printable characters '!' to '~'
+    chars = []
+    index += 1
+    while index > 0:
+        index -= 1
+        chars.append(chr(33 + index % 94))
+        index //= 94
+    return "".join(chars)
+
+
+def write_vcd(records, out):
+    pins = sorted({r["pin"] for r in records if r["event"] in ("pin_low", "pin_high", "pwm_set", "pulse_train")})
+    routines = sorted({r["routine"] for r in records})
+
+    signals = {}
+    for pin in pins:
+        signals[("pin", pin)] = _identifier(len(signals))
+    for routine in routines:
+        signals[("active", routine)] = _identifier(len(signals))
+        signals[("trigger", routine)] = _identifier(len(signals))
+
+    out.write("$timescale 1us $end\n$scope module trigger_pad $end\n")
+    for pin in pins:
+        out.write(f'$var wire 1 {signals[("pin", pin)]} pin{pin} $end\n')
+    for routine in routines:
+        out.write(f'$var wire 1 {signals[("active", routine)]} routine{routine}_active $end\n')
+        out.write(f'$var wire 1 {signals[("trigger", routine)]} routine{routine}_trigger $end\n')
+    out.write("$upscope $end\n$enddefinitions $end\n")
+
+    start = records[0]["time"] if records else 0
+    out.write("$dumpvars\n")
+    for identifier in signals.values():
+        out.write(f"x{identifier}\n")
+    out.write("$end\n")
+
+    changes = []
+    for r in records:
+        time = r["time"] - start
+        event = r["event"]
+        if event == "pin_low":
+            changes.append((time, f'0{signals[("pin", r["pin"])]}'))
+        elif event == "pin_high":
+            changes.append((time, f'1{signals[("pin", r["pin"])]}'))
+        elif event in ("pwm_set", "pulse_train"):
+            # The waveform itself is generated by hardware and not captured
+            changes.append((time, f'z{signals[("pin", r["pin"])]}'))
+        elif event == "start":
+            changes.append((time, f'1{signals[("active", r["routine"])]}'))
+        elif event == "finish":
+            changes.append((time, f'0{signals[("active", r["routine"])]}'))
+        elif event in ("trigger", "dropped"):
+            changes.append((time, f'1{signals[("trigger", r["routine"])]}'))
+            changes.append((time + 1, f'0{signals[("trigger", r["routine"])]}'))
+
+    changes.sort(key=lambda change: change[0])
+    current = None
+    for time, change in changes:
+        if time != current:
+            out.write(f"#{time}\n")
+            current = time
+        out.write(change + "\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", nargs="?", help="serial log containing the trace, stdin when omitted")
+    parser.add_argument("--format", choices=("vcd", "csv"), default="vcd")
+    parser.add_argument("-o", "--output", help="output file, stdout when omitted")
+    args = parser.parse_args()
+
+    source = open(args.input) if args.input else sys.stdin
+    with source:
+        records = parse(source)
+
+    out = open(args.output, "w") if args.output else sys.stdout
+    with out:
+        if args.format == "csv":
+            write_csv(records, out)
+        else:
+            write_vcd(records, out)
+
+
+if __name__ == "__main__":
+    main()